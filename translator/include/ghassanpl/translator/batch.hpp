@@ -0,0 +1,99 @@
+#pragma once
+
+#include "translator.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace translator
+{
+	/// A template to render by `batch_renderer::render`, with the variables to render it with
+	struct batch_job
+	{
+		/// Interpolated as by `context::interpolate` if `compiled` is not set
+		std::string_view source;
+		/// Rendered as by `context::interpolate_compiled`; should be compiled in the root context of the renderer (or its parents)
+		compiled_template const* compiled = nullptr;
+		/// An object of variable name → value pairs, set as local variables for this job only; may be null
+		json const* variables = nullptr;
+	};
+
+	struct batch_stats
+	{
+		size_t jobs = 0;
+		/// Jobs whose rendering reported an error (thrown, or recorded as a value); their results are the error messages
+		size_t failed_jobs = 0;
+		std::chrono::nanoseconds wall_time{};
+
+		struct worker_stats
+		{
+			size_t jobs = 0;
+			/// Number of times the worker took jobs from another worker after running out of its own
+			size_t steals = 0;
+			/// Time spent rendering jobs
+			std::chrono::nanoseconds busy_time{};
+			/// `busy_time` as a fraction of the wall time of the batch
+			double utilization = 0;
+		};
+		std::vector<worker_stats> workers;
+
+		double jobs_per_second() const noexcept
+		{
+			return wall_time.count() > 0 ? double(jobs) / std::chrono::duration<double>(wall_time).count() : 0.0;
+		}
+	};
+
+	/// Renders batches of templates on a pool of worker threads, each of which evaluates them in its own child context
+	/// of `root`. `root` is frozen (see `context::freeze`) by the constructor, and has to outlive the renderer.
+	///
+	/// The jobs of a batch are split evenly between the workers; workers that run out of jobs steal half of the remaining
+	/// jobs of another worker.
+	struct batch_renderer
+	{
+		/// Called once on each worker's context before it renders anything; can be used to set its handlers (which child contexts do not inherit)
+		using worker_setup_func = std::function<void(context&)>;
+
+		/// `worker_count` of 0 means one worker per hardware thread
+		explicit batch_renderer(context& root, size_t worker_count = 0, worker_setup_func worker_setup = {});
+		~batch_renderer();
+
+		batch_renderer(batch_renderer const&) = delete;
+		batch_renderer& operator=(batch_renderer const&) = delete;
+
+		/// Renders `count` jobs, writing the result of each to the corresponding element of `results`, which has to have room
+		/// for `count` strings. Blocks until all jobs are rendered; batches rendered from several threads are rendered one at a time.
+		batch_stats render(batch_job const* jobs, size_t count, std::string* results);
+		std::vector<std::string> render(std::vector<batch_job> const& jobs);
+
+		size_t worker_count() const noexcept { return m_workers.size(); }
+		context& root_context() const noexcept { return m_root; }
+
+	private:
+
+		struct worker;
+
+		context& m_root;
+		worker_setup_func m_worker_setup;
+		std::vector<std::unique_ptr<worker>> m_workers;
+
+		/// Serializes calls to `render`
+		std::mutex m_render_mutex;
+		std::mutex m_mutex;
+		std::condition_variable m_batch_started;
+		std::condition_variable m_batch_finished;
+		/// Incremented for every batch; workers wait for it to change
+		uint64_t m_batch_number = 0;
+		size_t m_busy_workers = 0;
+		bool m_stopping = false;
+
+		batch_job const* m_jobs = nullptr;
+		std::string* m_results = nullptr;
+		std::atomic<size_t> m_failed_jobs{ 0 };
+
+		void run_worker(worker& self);
+		void render_jobs(worker& self);
+		bool steal_jobs(worker& self);
+	};
+}
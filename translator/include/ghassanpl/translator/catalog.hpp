@@ -0,0 +1,109 @@
+#pragma once
+
+#include "translator.hpp"
+#include <filesystem>
+#include <iosfwd>
+#include <unordered_map>
+
+namespace translator
+{
+	/// Identifies a message in a `catalog`. Call sites can look it up once with `catalog::find` and skip the lookup afterwards.
+	struct message_id
+	{
+		uint32_t index = ~uint32_t{};
+
+		explicit operator bool() const noexcept { return index != ~uint32_t{}; }
+	};
+
+	/// A set of messages (message id → template pairs) that are parsed once, when loaded, and rendered on demand
+	/// in the context given to the constructor.
+	///
+	/// The ids, sources and parsed templates of all messages are stored together in an arena owned by the catalog.
+	/// Messages are compiled (see `context::compile`) the first time they are translated, and recompiled if functions
+	/// are bound in the context (or its parents) afterwards.
+	///
+	/// Translations are recorded by the render profiler of the context (see `context::set_render_profiler`), under their message ids.
+	///
+	/// If `options.track_source_spans` is set in the context when messages are added, errors in them refer to their positions in their
+	/// sources (see `source_map`); messages loaded from binary catalogs have no spans.
+	///
+	/// Parsed messages can also be saved in a binary format (see `save_binary`) and loaded from it (see `map_binary_file`)
+	/// without parsing anything; such messages are only decoded when they are first translated.
+	struct catalog
+	{
+		explicit catalog(context& ctx, std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+		~catalog();
+
+		/// Adds the message `id`, replacing the existing message with that id, if any
+		message_id add(std::string_view id, std::string_view source);
+
+		/// Adds the messages from `messages`, which should be an object of id → template string pairs
+		void load(json const& messages);
+		/// Adds the messages from a JSON file (see `load`)
+		void load_file(std::filesystem::path const& path);
+
+		/// Writes all messages in the binary catalog format. Function calls are resolved when messages are loaded from it,
+		/// so it can be used with any context whose parsing options are the same as this catalog's context's.
+		void save_binary(std::ostream& out);
+		void save_binary_file(std::filesystem::path const& path);
+
+		/// Adds the messages of a binary catalog (see `save_binary`) that is memory-mapped and used in place;
+		/// the mapping is kept until the catalog is destroyed
+		void map_binary_file(std::filesystem::path const& path);
+		/// Adds the messages of a binary catalog stored in `data` (which has to be 8-byte aligned), which is used in place,
+		/// so it has to outlive the catalog
+		void load_binary(void const* data, size_t size);
+
+		/// Folds the constant calls of all messages in the catalog's context (see `context::fold_constants`), decoding those
+		/// loaded from binary catalogs; returns the number of calls replaced. Should be called after binding all functions.
+		size_t fold_constants();
+
+		/// Returns an empty id if there is no message `id`
+		message_id find(std::string_view id) const noexcept;
+		size_t size() const noexcept { return m_entries.size(); }
+
+		std::string translate(std::string_view id);
+		std::string translate(message_id id);
+		void translate(std::string_view id, output_sink& sink);
+		void translate(message_id id, output_sink& sink);
+
+		context& linked_context() const noexcept { return m_context; }
+
+	private:
+
+		struct binary_image;
+
+		struct entry
+		{
+			std::string_view id;
+			std::string_view source;
+			tagged_value parsed;
+
+			/// For messages loaded from a binary catalog, the image and the root node of their template, which is decoded on first use
+			binary_image const* image = nullptr;
+			uint32_t root_node = 0;
+
+			/// Recompiled when it is not current (see `context::is_current`)
+			compiled_template compiled;
+		};
+
+		context& m_context;
+
+		/// Declared before the entries, which refer to them
+		std::unique_ptr<std::pmr::monotonic_buffer_resource> m_arena;
+		std::vector<std::unique_ptr<binary_image>> m_images;
+
+		std::vector<entry> m_entries;
+		std::unordered_map<std::string_view, uint32_t> m_ids;
+		/// The spans of the parsed messages of all entries
+		source_map m_spans;
+
+		std::string_view store(std::string_view str);
+		message_id add_entry(entry new_entry);
+		void add_binary_image(std::unique_ptr<binary_image> image);
+		tagged_value const& parsed(entry& message);
+		/// Compiles `message` if needed, and renders it
+		void render(entry& message, output_sink& sink);
+		tagged_value decode(binary_image const& image, uint32_t root_index);
+	};
+}
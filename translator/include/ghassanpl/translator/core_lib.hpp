@@ -0,0 +1,20 @@
+#pragma once
+
+#include "translator.hpp"
+
+namespace translator
+{
+	/// Binds the core library to `ctx`: conditionals (`[] ? [] : []`, `if [] then [] else []`, `match [] with [*] default []`),
+	/// comparisons (`[] == []`, ...), arithmetic (`[] + []`, ...), logical operators (`[] and [+]`, `[] or [+]`, `not []`),
+	/// concatenation (`[] , [+]`, `cat [] , [*] and []`), type queries, and `interpolate`, `parse` and `run`.
+	///
+	/// Its operators and conditionals are intrinsics (see `intrinsic_op`): compiled templates execute them directly instead of
+	/// calling their functions, unless they are overridden by functions bound later (in `ctx` or its children).
+	void open_core_lib(context& ctx);
+
+	namespace detail
+	{
+		/// Implements the comparison and arithmetic intrinsics for both the core library functions and compiled templates
+		json apply_binary_intrinsic(intrinsic_op op, json const& lhs, json const& rhs);
+	}
+}
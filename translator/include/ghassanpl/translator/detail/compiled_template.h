@@ -0,0 +1,88 @@
+#pragma once
+
+#include "functions.h"
+#include "source_map.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace translator
+{
+	/// A template (as returned by `context::parse` or `context::parse_value`) lowered into a flat instruction stream, so that
+	/// rendering it does not have to walk the parsed tree or search for functions again.
+	///
+	/// Functions are resolved against the context given to `context::compile`, so a compiled template
+	/// can only be run in that context (or its children), and needs to be recompiled if functions
+	/// are bound there after compilation (until then, it is recompiled from `source` the first time it is rendered after that,
+	/// and the result is reused until functions are bound again; see `context::is_current`).
+	/// Calls that could not be resolved at compile time are kept as-is and evaluated normally. Calls to functions that are
+	/// intrinsics (see `context::set_intrinsic`) are compiled into instructions that execute them directly, with their arguments.
+	struct compiled_template
+	{
+		enum class opcode : uint8_t
+		{
+			append_text,  /// Appends the string constant `operand` to the output
+			push_literal, /// Pushes a copy of the literal `operand` onto the value stack
+			load_var,     /// Pushes the value of the variable whose name is the symbol `operand`
+			call,         /// Pops `operand` arguments off the value stack and pushes the result of calling `function` with them
+			eval,         /// Pushes the result of evaluating the literal `operand` (calls that could not be resolved at compile time)
+			append_value, /// Pops a value off the value stack and appends its string representation to the output
+			append_var,   /// Appends the string representation of the variable whose name is the symbol `operand`, without copying its value
+
+			/// Intrinsics (see `intrinsic_op`); jump targets are instruction indices
+			jump,                 /// Continues at instruction `operand`
+			jump_if_false,        /// Pops a value off the value stack, and continues at instruction `operand` if it is false
+			jump_if_false_or_pop, /// Continues at instruction `operand` if the value on top of the value stack is false; pops it otherwise
+			jump_if_true_or_pop,  /// Continues at instruction `operand` if the value on top of the value stack is true; pops it otherwise
+			pop,                  /// Pops a value off the value stack
+			dup,                  /// Pushes a copy of the value on top of the value stack
+			logical_not,          /// Replaces the value on top of the value stack with whether it is false
+			binary_op,            /// Pops two values off the value stack and pushes the result of the `intrinsic_op` `operand` applied to them
+			concatenate_or_jump,  /// Pops a value off the value stack and appends its string representation to the string under it; if the value is an error,
+			                      /// it replaces the string instead, and execution continues at instruction `operand`
+		};
+
+		struct instruction
+		{
+			opcode op{};
+			uint32_t operand = 0;
+			defined_function const* function = nullptr;
+			/// For `call` instructions, index of the constant holding the call (for the call stack), or `no_constant`
+			uint32_t call_desc = no_constant;
+		};
+
+		static constexpr uint32_t no_constant = ~uint32_t{};
+
+		std::vector<instruction> code;
+		std::vector<tagged_value> constants;
+		/// The values pushed by `push_literal` and evaluated by `eval`, converted to `json` once, when the template is compiled
+		std::vector<json> literals;
+		/// If compiled with spans (see `context::compile`), the positions of the calls of `code` (one for each instruction;
+		/// other instructions have empty spans); empty otherwise
+		std::vector<source_span> spans;
+
+		/// The maximum number of values the value stack will hold while running this template
+		size_t max_stack_size = 0;
+
+		/// Symbols of the names of the variables this template can reference (see `context::referenced_variables`)
+		std::vector<symbol> variables;
+
+		/// The context this template was compiled (and its functions resolved) in
+		context const* linked_context = nullptr;
+		/// `context::bind_generation` of `linked_context` at the time this template was compiled
+		uint64_t bind_generation = 0;
+		/// The template this was compiled from, recompiled once functions were bound in `linked_context`
+		tagged_value source;
+
+		/// The template recompiled from `source` in `linked_context` since functions were bound there, if any;
+		/// shared by the copies of this template, which have the same source
+		struct relinked_template
+		{
+			std::mutex mutex;
+			std::shared_ptr<compiled_template const> compiled;
+		};
+		std::shared_ptr<relinked_template> relinked;
+
+		bool empty() const noexcept { return code.empty(); }
+	};
+}
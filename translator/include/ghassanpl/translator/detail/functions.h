@@ -1,7 +1,14 @@
 #pragma once
 
+#include "../translator_capi.h"
 #include "utils.h"
+#include "symbols.h"
 #include <set>
+#include <array>
+#include <chrono>
+#include <cassert>
+#include <cstring>
+#include <type_traits>
 
 namespace translator
 {
@@ -9,25 +16,222 @@ namespace translator
 	struct func_tree_element;
 	using tree_type = std::set<func_tree_element, std::less<>>;
 
+	/// The arguments of a call to a native function (see `native_eval_func`). Refers to storage owned by the caller, which the
+	/// function can modify (e.g. evaluate the arguments in place, or move from them) until it returns.
+	struct argument_span
+	{
+		argument_span() noexcept = default;
+		argument_span(json* data, size_t size) noexcept : m_data(data), m_size(size) {}
+
+		json* data() const noexcept { return m_data; }
+		size_t size() const noexcept { return m_size; }
+		bool empty() const noexcept { return m_size == 0; }
+
+		json& operator[](size_t index) const noexcept { assert(index < m_size); return m_data[index]; }
+		json* begin() const noexcept { return m_data; }
+		json* end() const noexcept { return m_data + m_size; }
+
+	private:
+
+		json* m_data = nullptr;
+		size_t m_size = 0;
+	};
+
+	/// Holds a callable `json(context&, argument_span)`. Unlike `std::function`, callables that fit in `inline_size` bytes
+	/// (function pointers, and lambdas that capture a few pointers) are always stored inline, trivially copyable ones are
+	/// copied without calling anything, and calling it is a single indirect call.
+	struct native_eval_func
+	{
+		static constexpr size_t inline_size = 3 * sizeof(void*);
+
+		native_eval_func() noexcept = default;
+		native_eval_func(std::nullptr_t) noexcept {}
+
+		template <typename FUNC, std::enable_if_t<!std::is_same_v<std::decay_t<FUNC>, native_eval_func> && std::is_invocable_r_v<json, std::decay_t<FUNC>&, context&, argument_span>, int> = 0>
+		native_eval_func(FUNC&& func)
+		{
+			using callable = std::decay_t<FUNC>;
+			if constexpr (stored_inline<callable>)
+			{
+				new (m_storage) callable(std::forward<FUNC>(func));
+				m_invoke = [](void* storage, context& ctx, argument_span args) -> json { return (*static_cast<callable*>(storage))(ctx, args); };
+				if constexpr (!std::is_trivially_copyable_v<callable>)
+					m_manage = &manage_inline<callable>;
+			}
+			else
+			{
+				*reinterpret_cast<callable**>(m_storage) = new callable(std::forward<FUNC>(func));
+				m_invoke = [](void* storage, context& ctx, argument_span args) -> json { return (**static_cast<callable**>(storage))(ctx, args); };
+				m_manage = &manage_heap<callable>;
+			}
+		}
+
+		native_eval_func(native_eval_func const& other) { copy_from(other); }
+		native_eval_func(native_eval_func&& other) noexcept { move_from(other); }
+		native_eval_func& operator=(native_eval_func const& other) { if (this != &other) { reset(); copy_from(other); } return *this; }
+		native_eval_func& operator=(native_eval_func&& other) noexcept { if (this != &other) { reset(); move_from(other); } return *this; }
+		~native_eval_func() { reset(); }
+
+		json operator()(context& ctx, argument_span args) const { return m_invoke(const_cast<unsigned char*>(m_storage), ctx, args); }
+
+		explicit operator bool() const noexcept { return m_invoke != nullptr; }
+
+	private:
+
+		enum class operation { copy, move, destroy };
+
+		using invoke_func = json(*)(void* storage, context&, argument_span);
+		using manage_func = void(*)(operation, void* storage, void* other_storage);
+
+		template <typename CALLABLE>
+		static constexpr bool stored_inline = sizeof(CALLABLE) <= inline_size && alignof(CALLABLE) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<CALLABLE>;
+
+		template <typename CALLABLE>
+		static void manage_inline(operation op, void* storage, void* other_storage)
+		{
+			switch (op)
+			{
+			case operation::copy: new (storage) CALLABLE(*static_cast<CALLABLE const*>(other_storage)); break;
+			case operation::move:
+				new (storage) CALLABLE(std::move(*static_cast<CALLABLE*>(other_storage)));
+				static_cast<CALLABLE*>(other_storage)->~CALLABLE();
+				break;
+			case operation::destroy: static_cast<CALLABLE*>(storage)->~CALLABLE(); break;
+			}
+		}
+
+		template <typename CALLABLE>
+		static void manage_heap(operation op, void* storage, void* other_storage)
+		{
+			auto& pointer = *static_cast<CALLABLE**>(storage);
+			switch (op)
+			{
+			case operation::copy: pointer = new CALLABLE(**static_cast<CALLABLE* const*>(other_storage)); break;
+			case operation::move: pointer = *static_cast<CALLABLE**>(other_storage); break;
+			case operation::destroy: delete pointer; break;
+			}
+		}
+
+		void copy_from(native_eval_func const& other)
+		{
+			if (other.m_manage)
+				other.m_manage(operation::copy, m_storage, const_cast<unsigned char*>(other.m_storage));
+			else
+				std::memcpy(m_storage, other.m_storage, inline_size);
+			m_invoke = other.m_invoke;
+			m_manage = other.m_manage;
+		}
+
+		void move_from(native_eval_func& other) noexcept
+		{
+			if (other.m_manage)
+				other.m_manage(operation::move, m_storage, other.m_storage);
+			else
+				std::memcpy(m_storage, other.m_storage, inline_size);
+			m_invoke = std::exchange(other.m_invoke, nullptr);
+			m_manage = std::exchange(other.m_manage, nullptr);
+		}
+
+		void reset() noexcept
+		{
+			if (m_manage)
+				m_manage(operation::destroy, m_storage, nullptr);
+			m_invoke = nullptr;
+			m_manage = nullptr;
+		}
+
+		invoke_func m_invoke = nullptr;
+		/// Null for callables that are trivially copyable and stored inline
+		manage_func m_manage = nullptr;
+		alignas(std::max_align_t) unsigned char m_storage[inline_size]{};
+	};
+
+	enum class function_flag : uint8_t
+	{
+		/// The function has no side effects, and its result depends only on its arguments (and the settings of the context),
+		/// so calls to it whose arguments are all literals can be evaluated ahead of time (see `context::fold_constants`)
+		pure,
+	};
+	using function_flags = enum_flags<function_flag, uint8_t>;
+
+	/// Operations that compiled templates can execute directly instead of calling the function that implements them
+	/// (see `context::set_intrinsic` and `open_core_lib`)
+	enum class intrinsic_op : uint8_t
+	{
+		none,
+		conditional,   /// `[] ? [] : []`; evaluates the condition, and then only one of the branches
+		equal,
+		not_equal,
+		greater,
+		greater_equal,
+		less,
+		less_equal,
+		add,
+		subtract,
+		multiply,
+		divide,
+		modulo,
+		logical_not,
+		logical_and,   /// `[] and [+]`; returns the first argument that is false (without evaluating the rest), or the last one
+		logical_or,    /// `[] or [+]`; returns the first argument that is true (without evaluating the rest), or the last one
+		concatenate,   /// `[] , [+]`; concatenates the string representations of the arguments
+		match,         /// `match [] with [*] default []`; each `with` argument is a `[value result]` pair
+	};
+
 	struct defined_function
 	{
-		/// TODO: This could be a std::string_view since we're storing signature strings in m_functions_by_sig
-		std::string signature; /// TODO: or std::vector<std::string> signatures;
+		/// Points into the symbol table of the root context, where the signature is interned
+		std::string_view signature; /// TODO: or std::vector<std::string_view> signatures;
 		std::function<json(context&, std::vector<json>)> func;
+		/// Set for functions bound with a `native_eval_func` (including those bound with `context::bind_simple_function`); called instead
+		/// of `func` with the (unevaluated) arguments of the call in place, so that they do not have to be moved into a vector first.
+		/// `func` is then an adapter that calls this.
+		native_eval_func native_func;
 		uintptr_t user_data = 0;
+		function_flags flags;
+		/// Set by `context::set_intrinsic`; reset when the function is rebound
+		intrinsic_op intrinsic = intrinsic_op::none;
+
+		bool pure() const noexcept { return flags.is_set(function_flag::pure); }
+	};
+
+	/// The calls to a function recorded with `options.profile_functions` set (see `context::function_profiles`)
+	struct function_profile
+	{
+		/// Points into the symbol table of the root context (see `defined_function::signature`)
+		std::string_view signature;
+		uint64_t calls = 0;
+		/// Time spent in the function, including the functions it called; the calls of a recursive function count towards the time of each
+		/// of its callers
+		std::chrono::nanoseconds inclusive_time{};
+		/// Time spent in the function itself, excluding the (profiled) functions it called
+		std::chrono::nanoseconds exclusive_time{};
+
+		static constexpr size_t arg_count_buckets = TRANSLATOR_PROFILE_ARG_COUNT_BUCKETS;
+		/// Number of calls with each argument count; the last bucket counts calls with `arg_count_buckets - 1` or more arguments
+		std::array<uint64_t, arg_count_buckets> calls_by_arg_count{};
+
+		void merge(function_profile const& other) noexcept
+		{
+			calls += other.calls;
+			inclusive_time += other.inclusive_time;
+			exclusive_time += other.exclusive_time;
+			for (size_t i = 0; i < arg_count_buckets; ++i)
+				calls_by_arg_count[i] += other.calls_by_arg_count[i];
+		}
 	};
 
 	struct func_tree_element
 	{
-		std::string name;
+		symbol name;
 		char modifier = 0; /// ? or * or +
 		enum_flags<json::value_t> valid_types = enum_flags<json::value_t>::all();
 
 		func_tree_element* parent = nullptr;
 
 		bool operator<(func_tree_element const& other) const noexcept { return std::tie(name, modifier, valid_types) < std::tie(other.name, other.modifier, other.valid_types); }
-		friend bool operator<(func_tree_element const& self, std::string_view other) noexcept { return self.name < other; }
-		friend bool operator<(std::string_view other, func_tree_element const& self) noexcept { return other < self.name; }
+		friend bool operator<(func_tree_element const& self, symbol other) noexcept { return self.name < other; }
+		friend bool operator<(symbol other, func_tree_element const& self) noexcept { return other < self.name; }
 
 		mutable tree_type child_elements;
 		mutable defined_function* leaf = nullptr;
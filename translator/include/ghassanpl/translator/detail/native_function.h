@@ -0,0 +1,85 @@
+#pragma once
+
+#include "utils.h"
+#include <string_view>
+#include <type_traits>
+
+namespace translator
+{
+	struct context;
+
+	namespace detail
+	{
+		template <typename... T>
+		struct type_list {};
+
+		/// Deduces the result and parameter types of functions, function pointers and (non-generic) lambdas
+		template <typename FUNC>
+		struct callable_traits : callable_traits<decltype(&FUNC::operator())> {};
+
+		template <typename RESULT, typename... ARGS>
+		struct callable_traits<RESULT(*)(ARGS...)>
+		{
+			using result_type = RESULT;
+			using argument_types = type_list<ARGS...>;
+		};
+		template <typename RESULT, typename... ARGS>
+		struct callable_traits<RESULT(ARGS...)> : callable_traits<RESULT(*)(ARGS...)> {};
+		template <typename CLASS, typename RESULT, typename... ARGS>
+		struct callable_traits<RESULT(CLASS::*)(ARGS...)> : callable_traits<RESULT(*)(ARGS...)> {};
+		template <typename CLASS, typename RESULT, typename... ARGS>
+		struct callable_traits<RESULT(CLASS::*)(ARGS...) const> : callable_traits<RESULT(*)(ARGS...)> {};
+
+		/// Converts evaluated arguments to the parameter types of functions bound with `context::bind_simple_function`;
+		/// `accepts` checks the type of the value, and `get` converts it (possibly moving from it)
+		template <typename T, typename = void>
+		struct native_arg
+		{
+			static_assert(!std::is_same_v<T, T>, "unsupported parameter type for a simple function (supported are json, bool, numbers, std::string and std::string_view)");
+		};
+
+		template <>
+		struct native_arg<json>
+		{
+			static constexpr std::string_view type_name = "any value";
+			static bool accepts(json const&) noexcept { return true; }
+			static json&& get(json& value) noexcept { return std::move(value); }
+		};
+
+		template <>
+		struct native_arg<bool>
+		{
+			static constexpr std::string_view type_name = "boolean";
+			static bool accepts(json const& value) noexcept { return value.is_boolean(); }
+			static bool get(json& value) { return value.get<bool>(); }
+		};
+
+		template <typename T>
+		struct native_arg<T, std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>>>
+		{
+			static constexpr std::string_view type_name = "number";
+			static bool accepts(json const& value) noexcept { return value.is_number(); }
+			static T get(json& value) { return value.get<T>(); }
+		};
+
+		template <>
+		struct native_arg<std::string>
+		{
+			static constexpr std::string_view type_name = "string";
+			static bool accepts(json const& value) noexcept { return value.is_string(); }
+			static std::string&& get(json& value) { return std::move(value.get_ref<json::string_t&>()); }
+		};
+
+		/// Refers to the evaluated argument, which lives until the function returns
+		template <>
+		struct native_arg<std::string_view>
+		{
+			static constexpr std::string_view type_name = "string";
+			static bool accepts(json const& value) noexcept { return value.is_string(); }
+			static std::string_view get(json& value) { return value.get_ref<json::string_t const&>(); }
+		};
+
+		template <typename T>
+		constexpr bool is_context_param = std::is_same_v<std::remove_cv_t<std::remove_reference_t<T>>, context>;
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <algorithm>
+
+namespace translator
+{
+	/// Where the `interpolate_*_to` functions write their output: appends to a `std::string`, writes into
+	/// a fixed `char` buffer, or calls a function with each piece of output, without building any intermediate strings.
+	struct output_sink
+	{
+		using write_func = void(*)(void* user_data, char const* data, size_t size);
+
+		/// Appends to `str`
+		output_sink(std::string& str) noexcept : m_kind(kind::string), m_string(&str) {}
+
+		/// Writes into `buffer`, keeping it null-terminated; output that does not fit is dropped (see `truncated()`)
+		output_sink(char* buffer, size_t buffer_size) noexcept
+			: m_kind(kind::buffer), m_buffer(buffer), m_buffer_size(buffer_size)
+		{
+			if (m_buffer_size)
+				m_buffer[0] = 0;
+		}
+		template <size_t N>
+		output_sink(char (&buffer)[N]) noexcept : output_sink(buffer, N) {}
+
+		/// Calls `write` with each piece of output
+		output_sink(write_func write, void* user_data) noexcept : m_kind(kind::callback), m_write(write), m_user_data(user_data) {}
+
+		void append(std::string_view str)
+		{
+			switch (m_kind)
+			{
+			case kind::string:
+				m_string->append(str);
+				break;
+			case kind::buffer:
+				if (m_size + 1 < m_buffer_size)
+				{
+					const auto fits = std::min(str.size(), m_buffer_size - 1 - m_size);
+					std::memcpy(m_buffer + m_size, str.data(), fits);
+					m_buffer[m_size + fits] = 0;
+				}
+				break;
+			case kind::callback:
+				if (!str.empty())
+					m_write(m_user_data, str.data(), str.size());
+				break;
+			}
+			m_size += str.size();
+		}
+		void append(char ch) { append(std::string_view{ &ch, 1 }); }
+
+		/// Number of characters appended so far, including the ones that did not fit in the buffer
+		size_t size() const noexcept { return m_size; }
+
+		/// Whether some of the output did not fit in the buffer
+		bool truncated() const noexcept { return m_kind == kind::buffer && m_size + 1 > m_buffer_size; }
+
+	private:
+
+		enum class kind { string, buffer, callback };
+		kind m_kind;
+
+		std::string* m_string = nullptr;
+
+		char* m_buffer = nullptr;
+		size_t m_buffer_size = 0;
+
+		write_func m_write = nullptr;
+		void* m_user_data = nullptr;
+
+		size_t m_size = 0;
+	};
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "source_map.h"
+#include <memory>
+#include <memory_resource>
+
+namespace translator
+{
+	struct context;
+
+	/// A template parsed by `context::parse_template`.
+	///
+	/// All of its nodes (and the text that can't be stored inline) are allocated from a monotonic arena owned by the template,
+	/// so parsing it takes a few large allocations instead of one per node, and destroying it releases them all at once,
+	/// without walking the tree. The template also keeps a copy of its source in the arena, and text that did not need
+	/// unescaping refers to it instead of being copied.
+	struct parsed_template
+	{
+		explicit parsed_template(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+			: m_arena(std::make_unique<std::pmr::monotonic_buffer_resource>(upstream))
+		{
+		}
+
+		tagged_value const& root() const noexcept { return m_root; }
+		std::string_view source() const noexcept { return m_source; }
+		/// The spans of the calls and atoms of the template, if it was parsed with `options.track_source_spans` set
+		/// (and its constants were not folded since)
+		source_map const& spans() const noexcept { return m_spans; }
+
+		/// Values borrowed from this arena can be added to the template's tree
+		std::pmr::memory_resource* arena() const noexcept { return m_arena.get(); }
+
+	private:
+
+		friend struct context;
+
+		/// Declared before `m_root` so it outlives it
+		std::unique_ptr<std::pmr::monotonic_buffer_resource> m_arena;
+		std::string_view m_source;
+		tagged_value m_root;
+		source_map m_spans;
+	};
+}
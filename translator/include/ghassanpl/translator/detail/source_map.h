@@ -0,0 +1,132 @@
+#pragma once
+
+#include "value.h"
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+
+namespace translator
+{
+	namespace detail { struct span_recorder; }
+
+	/// The position of a call or atom in the source it was parsed from: bytes [begin, end), and the (1-based) line and column of `begin`,
+	/// where columns are counted in bytes
+	struct source_span
+	{
+		uint32_t begin = 0;
+		uint32_t end = 0;
+		uint32_t line = 0;
+		uint32_t column = 0;
+	};
+
+	/// The spans of the calls and atoms of a parsed template, kept apart from its values, so that they stay as compact as they are
+	/// without them, and parsing only pays for spans when they are asked for (see `context::parse`).
+	///
+	/// Nodes are identified by their addresses, so a map is only valid for the tree it was made for, as long as the nodes are not
+	/// modified or moved. Moving the whole tree is fine, as its elements stay where they are; copying it is not. `context::fold_constants`
+	/// updates the map it is given.
+	struct source_map
+	{
+		std::optional<source_span> find(json const& node) const noexcept { return find_node(&node); }
+		std::optional<source_span> find(tagged_value const& node) const noexcept { return find_node(&node); }
+
+		size_t size() const noexcept { return m_spans.size(); }
+		bool empty() const noexcept { return m_spans.empty(); }
+		void clear() noexcept { m_spans.clear(); }
+
+	private:
+
+		friend struct context;
+		friend struct detail::span_recorder;
+
+		std::unordered_map<void const*, source_span> m_spans;
+
+		std::optional<source_span> find_node(void const* node) const noexcept
+		{
+			if (auto it = m_spans.find(node); it != m_spans.end())
+				return it->second;
+			return std::nullopt;
+		}
+	};
+
+	namespace detail
+	{
+		/// Collects the spans of the nodes read by the parser, in the order they are started (i.e. the pre-order of the tree). The addresses
+		/// of the nodes are not known until the tree is complete (as arrays grow while it is parsed), so the spans are matched with them afterwards.
+		struct span_recorder
+		{
+			explicit span_recorder(std::string_view source)
+				: m_source(source.data())
+			{
+				for (size_t i = source.find('\n'); i != std::string_view::npos; i = source.find('\n', i + 1))
+					m_line_starts.push_back(uint32_t(i + 1));
+			}
+
+			/// Starts the span of a node at `at`; returns its index, to be given to `end`
+			size_t begin(char const* at)
+			{
+				const auto offset = uint32_t(at - m_source);
+				/// Index of the first line start after `offset` is the number of line starts at or before it, i.e. the 0-based line
+				const auto line = uint32_t(std::upper_bound(m_line_starts.begin(), m_line_starts.end(), offset) - m_line_starts.begin());
+				const auto line_start = line ? m_line_starts[line - 1] : 0;
+				spans.push_back({ offset, offset, line + 1, offset - line_start + 1 });
+				return spans.size() - 1;
+			}
+
+			void end(size_t index, char const* at) { spans[index].end = uint32_t(at - m_source); }
+
+			/// Forgets the spans of the children of the node `index`, which was replaced by an error
+			void drop_children(size_t index) { spans.resize(index + 1); }
+			/// Forgets the span of the node `index` (and its children), which was not added to the tree
+			void discard(size_t index) { spans.resize(index); }
+
+			/// Adds the spans to `map`, for the calls of the finished template `parsed` (as returned by `context::parse` or `context::parse_value`)
+			/// and their elements; top-level text has no spans
+			template <typename NODE>
+			void assign_calls(NODE const& parsed, source_map& map) const
+			{
+				size_t next = 0;
+				for (auto const& node : elements_of(parsed))
+				{
+					if (is_list(node))
+						assign(node, next, map);
+				}
+			}
+
+			/// Adds the spans to `map` for the elements of `call` (whose own span is not recorded, as in `context::parse_call`)
+			template <typename NODE>
+			void assign_elements(NODE const& call, source_map& map) const
+			{
+				size_t next = 0;
+				for (auto const& node : elements_of(call))
+					assign(node, next, map);
+			}
+
+			static bool is_list(json const& node) noexcept { return node.is_array(); }
+			static bool is_list(tagged_value const& node) noexcept { return node.has_elements(); }
+
+			std::vector<source_span> spans;
+
+		private:
+
+			static json const& elements_of(json const& node) noexcept { return node; }
+			static tagged_value::array_t const& elements_of(tagged_value const& node) noexcept { return node.elements(); }
+
+			template <typename NODE>
+			void assign(NODE const& node, size_t& next, source_map& map) const
+			{
+				if (next >= spans.size())
+					return;
+				map.m_spans[&node] = spans[next++];
+				if (is_list(node))
+				{
+					for (auto const& element : elements_of(node))
+						assign(element, next, map);
+				}
+			}
+
+			char const* m_source = nullptr;
+			std::vector<uint32_t> m_line_starts;
+		};
+	}
+}
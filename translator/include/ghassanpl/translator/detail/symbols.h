@@ -0,0 +1,191 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <mutex>
+
+namespace translator
+{
+	/// Identifies a string interned in a `symbol_table`; only meaningful within the table that created it.
+	/// The default-constructed symbol is never returned by `symbol_table::intern`, and means "no symbol".
+	struct symbol
+	{
+		uint32_t id = 0;
+
+		constexpr explicit operator bool() const noexcept { return id != 0; }
+
+		friend constexpr bool operator==(symbol a, symbol b) noexcept { return a.id == b.id; }
+		friend constexpr bool operator!=(symbol a, symbol b) noexcept { return a.id != b.id; }
+		friend constexpr bool operator<(symbol a, symbol b) noexcept { return a.id < b.id; }
+	};
+
+	/// Interns words, parameter names, signatures and variable names, so that they are stored once
+	/// and can be compared as integers. Owned by the root context (see `context::symbols`).
+	///
+	/// Reads (`find`, `name` and `size`) never lock, so any number of threads can read the table at once: names are stored
+	/// in chunks that never move, and found through an open-addressing hash table of symbols, and both are only ever appended to,
+	/// with each new symbol published (with release/acquire ordering) after it is complete. A grown hash table replaces the old one,
+	/// which is kept until the symbol table is destroyed, as readers may still be probing it.
+	///
+	/// Adding a symbol is not thread-safe until `make_thread_safe` is called (see `context::freeze`); after that, `intern` takes a lock
+	/// when it has to add a symbol (symbols that already exist are found without one).
+	struct symbol_table
+	{
+		symbol_table() = default;
+		~symbol_table()
+		{
+			for (auto& chunk : m_chunks)
+				delete[] chunk.load(std::memory_order_relaxed);
+		}
+
+		symbol_table(symbol_table const&) = delete;
+		symbol_table& operator=(symbol_table const&) = delete;
+
+		/// Returns the symbol for `str`, adding it to the table if necessary
+		symbol intern(std::string_view str)
+		{
+			if (const auto result = find(str))
+				return result;
+			if (m_thread_safe)
+			{
+				std::lock_guard lock{ m_mutex };
+				return intern_unlocked(str);
+			}
+			return intern_unlocked(str);
+		}
+
+		/// Returns the symbol for `str`, or an empty symbol if `str` was never interned
+		symbol find(std::string_view str) const noexcept
+		{
+			const auto table = m_table.load(std::memory_order_acquire);
+			if (!table)
+				return {};
+
+			const auto hash = hash_of(str);
+			for (auto bucket = size_t(hash) & table->mask; ; bucket = (bucket + 1) & table->mask)
+			{
+				const auto slot = table->slots[bucket].load(std::memory_order_acquire);
+				if (!slot)
+					return {};
+				if (uint32_t(slot >> 32) == hash && name_at(uint32_t(slot) - 1) == str)
+					return symbol{ uint32_t(slot) };
+			}
+		}
+
+		std::string_view name(symbol sym) const noexcept
+		{
+			if (!sym || sym.id > m_size.load(std::memory_order_acquire))
+				return {};
+			return name_at(sym.id - 1);
+		}
+
+		size_t size() const noexcept { return m_size.load(std::memory_order_acquire); }
+
+		/// Makes `intern` safe to call from many threads at once. Has to be called before other threads start using the table,
+		/// and cannot be undone.
+		void make_thread_safe() noexcept { m_thread_safe = true; }
+		bool thread_safe() const noexcept { return m_thread_safe; }
+
+	private:
+
+		/// Chunk `k` holds `first_chunk_size << k` names, so the chunk directory is small and never has to grow
+		static constexpr size_t first_chunk_bits = 6;
+		static constexpr size_t first_chunk_size = size_t(1) << first_chunk_bits;
+		static constexpr size_t max_chunks = 32 - first_chunk_bits;
+
+		std::array<std::atomic<std::string*>, max_chunks> m_chunks{};
+		std::atomic<uint32_t> m_size{ 0 };
+
+		/// Each slot holds the hash of a name in its upper 32 bits and its symbol in the lower ones; empty slots are 0
+		struct hash_table
+		{
+			explicit hash_table(size_t bucket_count) : mask(bucket_count - 1), slots(new std::atomic<uint64_t>[bucket_count]()) {}
+			size_t mask = 0;
+			std::unique_ptr<std::atomic<uint64_t>[]> slots;
+		};
+		std::atomic<hash_table*> m_table{ nullptr };
+		/// The current table and all the ones it replaced
+		std::vector<std::unique_ptr<hash_table>> m_tables;
+
+		bool m_thread_safe = false;
+		/// Only taken by `intern` (once the table is thread-safe), to serialize writers
+		std::mutex m_mutex;
+
+		static uint32_t hash_of(std::string_view str) noexcept
+		{
+			/// FNV-1a
+			uint32_t result = 2166136261u;
+			for (const auto ch : str)
+				result = (result ^ uint8_t(ch)) * 16777619u;
+			return result;
+		}
+
+		static std::pair<size_t, size_t> chunk_of(size_t index) noexcept
+		{
+			const auto scaled = (index >> first_chunk_bits) + 1;
+			size_t chunk = 0;
+			while (scaled >> (chunk + 1))
+				++chunk;
+			return { chunk, index - ((size_t(1) << chunk) - 1) * first_chunk_size };
+		}
+
+		std::string_view name_at(size_t index) const noexcept
+		{
+			const auto [chunk, offset] = chunk_of(index);
+			return m_chunks[chunk].load(std::memory_order_acquire)[offset];
+		}
+
+		static void insert(hash_table& table, uint64_t slot) noexcept
+		{
+			auto bucket = size_t(slot >> 32) & table.mask;
+			while (table.slots[bucket].load(std::memory_order_relaxed))
+				bucket = (bucket + 1) & table.mask;
+			table.slots[bucket].store(slot, std::memory_order_release);
+		}
+
+		symbol intern_unlocked(std::string_view str)
+		{
+			/// Another writer may have added it since `find` looked
+			if (const auto result = find(str))
+				return result;
+
+			const auto index = m_size.load(std::memory_order_relaxed);
+			const auto [chunk, offset] = chunk_of(index);
+			auto names = m_chunks[chunk].load(std::memory_order_relaxed);
+			if (!names)
+			{
+				names = new std::string[first_chunk_size << chunk];
+				m_chunks[chunk].store(names, std::memory_order_release);
+			}
+			names[offset] = str;
+
+			/// Keep the hash table at most half full; readers of the old table keep probing it until they are done
+			auto table = m_table.load(std::memory_order_relaxed);
+			if (!table || (size_t(index) + 1) * 2 > table->mask + 1)
+			{
+				auto grown = std::make_unique<hash_table>(table ? (table->mask + 1) * 2 : 64);
+				if (table)
+				{
+					for (size_t i = 0; i <= table->mask; ++i)
+					{
+						if (const auto slot = table->slots[i].load(std::memory_order_relaxed))
+							insert(*grown, slot);
+					}
+				}
+				table = m_tables.emplace_back(std::move(grown)).get();
+				m_table.store(table, std::memory_order_release);
+			}
+
+			const auto result = symbol{ index + 1 };
+			/// The name has to be visible before the symbol can be found
+			m_size.store(result.id, std::memory_order_release);
+			insert(*table, (uint64_t(hash_of(str)) << 32) | result.id);
+			return result;
+		}
+	};
+}
@@ -83,12 +83,36 @@ namespace translator
 
 	using nlohmann::json;
 
+	/// Binary subtype of `json` values that are errors (see `translator_context::options.errors_as_values`)
+	inline constexpr uint8_t json_error_subtype = 0xEE;
+
+	inline bool is_error_value(json const& val) noexcept
+	{
+		return val.is_binary() && val.get_binary().has_subtype() && val.get_binary().subtype() == json_error_subtype;
+	}
+
+	inline json make_error_value(std::string_view message)
+	{
+		return json::binary(json::binary_t::container_type{ message.begin(), message.end() }, json_error_subtype);
+	}
+
+	/// Returns an empty string if `val` is not an error value
+	inline std::string_view error_message(json const& val) noexcept
+	{
+		if (!is_error_value(val))
+			return {};
+		auto const& binary = val.get_binary();
+		return { (char const*)binary.data(), binary.size() };
+	}
+
+	/// Errors are false, so that conditions on data that failed to be retrieved take their "else" branches
 	inline bool is_true(json const& val) noexcept
 	{
 		switch (val.type())
 		{
 		case json::value_t::boolean: return bool(val);
 		case json::value_t::null: return false;
+		case json::value_t::binary: return !is_error_value(val);
 		default: return true;
 		}
 	}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "utils.h"
+#include "symbols.h"
+#include <vector>
+#include <memory_resource>
+#include <cstring>
+#include <cassert>
+
+namespace translator
+{
+	/// Compact (16 byte) tagged value used internally by the parser and evaluator.
+	///
+	/// Unlike `json`, it distinguishes words from strings, calls from arrays, and errors from everything else.
+	/// Strings of up to `small_string_capacity` bytes are stored inline.
+	/// Words are stored as symbols of the symbol table of the context that created them,
+	/// so converting a value to `json` requires that table.
+	///
+	/// Values can be allocated from an arena (see the `arena` parameters); such values are "borrowed": destroying them
+	/// frees nothing, and the arena has to outlive them. Copies of borrowed values are always heap-allocated.
+	struct tagged_value
+	{
+		enum class kind : uint8_t
+		{
+			null,
+			boolean,
+			integer,
+			unsigned_integer,
+			floating,
+			string,
+			word,
+			call,
+			array,
+			object,
+			error,
+		};
+
+		using array_t = std::pmr::vector<tagged_value>;
+		using object_t = std::map<std::string, tagged_value, std::less<>>;
+
+		static constexpr size_t small_string_capacity = 14;
+
+		/// Binary subtype used to carry error values through `json`
+		static constexpr uint8_t json_error_subtype = translator::json_error_subtype;
+
+		tagged_value() noexcept { m_small.tag = kind::null; m_small.size = 0; }
+		tagged_value(std::nullptr_t) noexcept : tagged_value() {}
+		tagged_value(bool val) noexcept : tagged_value() { m_large.tag = kind::boolean; m_large.payload.boolean = val; }
+		tagged_value(double val) noexcept : tagged_value() { m_large.tag = kind::floating; m_large.payload.floating = val; }
+		template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+		tagged_value(T val) noexcept : tagged_value()
+		{
+			if constexpr (std::is_signed_v<T>)
+			{
+				m_large.tag = kind::integer;
+				m_large.payload.integer = val;
+			}
+			else
+			{
+				m_large.tag = kind::unsigned_integer;
+				m_large.payload.unsigned_integer = val;
+			}
+		}
+		tagged_value(std::string_view str) : tagged_value() { set_text(kind::string, str); }
+		tagged_value(char const* str) : tagged_value(std::string_view{ str }) {}
+		tagged_value(std::string const& str) : tagged_value(std::string_view{ str }) {}
+		/// Copies `str` into `arena` (unless it can be stored inline); `arena` can be null
+		tagged_value(std::string_view str, std::pmr::memory_resource* arena) : tagged_value() { set_text(kind::string, str, arena); }
+
+		static tagged_value make_word(symbol sym) noexcept { tagged_value result; result.m_large.tag = kind::word; result.m_large.payload.word = sym.id; return result; }
+		/// A string that refers to `str` instead of copying it, so `str` has to outlive it (and its copies are heap-allocated as usual).
+		/// Short strings are still stored inline, as that is cheaper than referring to them.
+		static tagged_value make_view(std::string_view str) noexcept;
+
+		/// If `arena` is not null, the elements are moved into an array allocated from it; they should themselves be borrowed from it, as they will never be destroyed
+		static tagged_value make_call(array_t elements, std::pmr::memory_resource* arena = nullptr) { return tagged_value{ kind::call, std::move(elements), arena }; }
+		static tagged_value make_array(array_t elements, std::pmr::memory_resource* arena = nullptr) { return tagged_value{ kind::array, std::move(elements), arena }; }
+		static tagged_value make_object(object_t members) { tagged_value result; result.m_large.tag = kind::object; result.m_large.payload.object = new object_t(std::move(members)); return result; }
+		static tagged_value make_error(std::string_view message, std::pmr::memory_resource* arena = nullptr) { tagged_value result; result.set_text(kind::error, message, arena); return result; }
+
+		tagged_value(tagged_value const& other);
+		tagged_value(tagged_value&& other) noexcept { std::memcpy((void*)this, (void const*)&other, sizeof(tagged_value)); other.m_small.tag = kind::null; }
+		tagged_value& operator=(tagged_value const& other);
+		tagged_value& operator=(tagged_value&& other) noexcept;
+		~tagged_value() { release(); }
+
+		kind type() const noexcept { return m_small.tag; }
+
+		bool is_null() const noexcept { return type() == kind::null; }
+		bool is_boolean() const noexcept { return type() == kind::boolean; }
+		bool is_number() const noexcept { return type() == kind::integer || type() == kind::unsigned_integer || type() == kind::floating; }
+		bool is_string() const noexcept { return type() == kind::string; }
+		bool is_word() const noexcept { return type() == kind::word; }
+		bool is_call() const noexcept { return type() == kind::call; }
+		bool is_array() const noexcept { return type() == kind::array; }
+		bool is_object() const noexcept { return type() == kind::object; }
+		bool is_error() const noexcept { return type() == kind::error; }
+
+		/// Whether the value's storage is owned by someone else (e.g. an arena), so that destroying it frees nothing
+		bool is_borrowed() const noexcept { return m_large.size == borrowed; }
+
+		/// Whether the value has text accessible through `str()` (strings and error messages)
+		bool has_text() const noexcept { return type() == kind::string || type() == kind::error; }
+		/// Whether the value has elements accessible through `elements()` (calls and arrays)
+		bool has_elements() const noexcept { return type() == kind::call || type() == kind::array; }
+
+		bool as_boolean() const noexcept { return m_large.payload.boolean; }
+		int64_t as_integer() const noexcept { return m_large.payload.integer; }
+		uint64_t as_unsigned() const noexcept { return m_large.payload.unsigned_integer; }
+		double as_double() const noexcept { return m_large.payload.floating; }
+		symbol as_word() const noexcept { return symbol{ m_large.payload.word }; }
+
+		std::string_view str() const noexcept
+		{
+			assert(has_text());
+			if (m_small.size == heap_text)
+				return *m_large.payload.text;
+			if (m_small.size == borrowed)
+				return { m_large.payload.chars, m_large.length };
+			return { m_small.chars, m_small.size };
+		}
+
+		array_t& elements() noexcept { assert(has_elements()); return *m_large.payload.elements; }
+		array_t const& elements() const noexcept { assert(has_elements()); return *m_large.payload.elements; }
+		object_t& members() noexcept { assert(is_object()); return *m_large.payload.object; }
+		object_t const& members() const noexcept { assert(is_object()); return *m_large.payload.object; }
+
+		/// Converts to `json`; words become strings, calls become arrays and errors become binary values with `json_error_subtype`
+		json to_json(symbol_table const& symbols) const;
+
+		/// Converts from `json`; strings are kept as strings, as there is no way to tell if they were words
+		static tagged_value from_json(json const& j);
+
+	private:
+
+		static constexpr uint8_t heap_text = 0xFF;
+		static constexpr uint8_t borrowed = 0xFE;
+
+		union
+		{
+			/// Strings and errors of up to `small_string_capacity` bytes
+			struct
+			{
+				kind tag;
+				uint8_t size; /// `heap_text` if the text is stored in `m_large.payload.text`, `borrowed` if it is in `m_large.payload.chars`
+				char chars[small_string_capacity];
+			} m_small;
+
+			struct
+			{
+				kind tag;
+				uint8_t size; /// `borrowed` if the payload is not owned by this value
+				uint32_t length; /// Length of borrowed text
+				union
+				{
+					bool boolean;
+					int64_t integer;
+					uint64_t unsigned_integer;
+					double floating;
+					uint32_t word; /// `symbol::id`
+					std::string* text;
+					char const* chars;
+					array_t* elements;
+					object_t* object;
+				} payload;
+			} m_large;
+		};
+
+		tagged_value(kind k, array_t elements, std::pmr::memory_resource* arena);
+
+		void set_text(kind k, std::string_view str, std::pmr::memory_resource* arena = nullptr);
+		void release() noexcept;
+	};
+
+	static_assert(sizeof(tagged_value) == 16);
+}
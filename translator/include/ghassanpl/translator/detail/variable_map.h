@@ -0,0 +1,208 @@
+#pragma once
+
+#include "utils.h"
+#include "symbols.h"
+#include <atomic>
+#include <deque>
+#include <vector>
+
+namespace translator
+{
+	/// The variables of a context, keyed by the symbols of their names.
+	///
+	/// Values are stored in slots that never move (so references to them stay valid until they are erased), and found
+	/// through an open-addressing hash table of slot indices, so a lookup is a single hashed probe (plus a short linear scan
+	/// on collisions). Slots of erased variables are reused.
+	struct variable_map
+	{
+		struct entry
+		{
+			symbol first;
+			json second;
+		};
+
+		struct iterator
+		{
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = entry;
+			using difference_type = std::ptrdiff_t;
+			using pointer = entry*;
+			using reference = entry&;
+
+			iterator() noexcept = default;
+
+			entry& operator*() const noexcept { return *m_it; }
+			entry* operator->() const noexcept { return &*m_it; }
+
+			iterator& operator++() noexcept { ++m_it; skip_erased(); return *this; }
+			iterator operator++(int) noexcept { auto result = *this; ++*this; return result; }
+
+			friend bool operator==(iterator const& a, iterator const& b) noexcept { return a.m_it == b.m_it; }
+			friend bool operator!=(iterator const& a, iterator const& b) noexcept { return a.m_it != b.m_it; }
+
+		private:
+
+			friend struct variable_map;
+			using base_iterator = std::deque<entry>::iterator;
+
+			iterator(base_iterator it, base_iterator end) noexcept : m_it(it), m_end(end) { skip_erased(); }
+
+			void skip_erased() noexcept
+			{
+				while (m_it != m_end && !m_it->first)
+					++m_it;
+			}
+
+			base_iterator m_it{};
+			base_iterator m_end{};
+		};
+
+		iterator begin() noexcept { return { m_slots.begin(), m_slots.end() }; }
+		iterator end() noexcept { return { m_slots.end(), m_slots.end() }; }
+
+		size_t size() const noexcept { return m_size; }
+		bool empty() const noexcept { return m_size == 0; }
+
+		/// Incremented whenever a variable is added or erased (but not when a value changes);
+		/// used to invalidate cached lookups (see `context::find_variable`)
+		uint64_t generation() const noexcept { return m_generation; }
+
+		/// Makes every change of `generation` also increment `counter` (which has to outlive this map)
+		void share_generation(std::atomic<uint64_t>* counter) noexcept { m_shared_generation = counter; }
+
+		iterator find(symbol name) noexcept
+		{
+			if (m_size == 0 || !name)
+				return end();
+			for (auto bucket = bucket_of(name); m_buckets[bucket]; bucket = next_bucket(bucket))
+			{
+				const auto slot = m_buckets[bucket] - 1;
+				if (m_slots[slot].first == name)
+					return iterator_at(slot);
+			}
+			return end();
+		}
+
+		/// Does nothing (and returns the existing variable) if there already is a variable `name`
+		std::pair<iterator, bool> emplace(symbol name, json value)
+		{
+			if (auto it = find(name); it != end())
+				return { it, false };
+
+			/// Keep the table at most half full
+			if ((m_size + 1) * 2 > m_buckets.size())
+				rehash(std::max(m_buckets.size() * 2, size_t(16)));
+
+			uint32_t slot;
+			if (!m_free_slots.empty())
+			{
+				slot = m_free_slots.back();
+				m_free_slots.pop_back();
+				m_slots[slot] = { name, std::move(value) };
+			}
+			else
+			{
+				slot = uint32_t(m_slots.size());
+				m_slots.push_back({ name, std::move(value) });
+			}
+
+			insert_bucket(name, slot);
+			++m_size;
+			next_generation();
+			return { iterator_at(slot), true };
+		}
+
+		json& operator[](symbol name) { return emplace(name, nullptr).first->second; }
+
+		void erase(iterator it)
+		{
+			const auto slot = uint32_t(it.m_it - m_slots.begin());
+			const auto name = it->first;
+
+			/// Backward-shift deletion, so that no tombstones are needed in the table
+			auto bucket = bucket_of(name);
+			while (m_buckets[bucket] != slot + 1)
+				bucket = next_bucket(bucket);
+			for (auto next = next_bucket(bucket); m_buckets[next]; next = next_bucket(next))
+			{
+				const auto ideal = bucket_of(m_slots[m_buckets[next] - 1].first);
+				/// Move the entry at `next` into the hole if the hole lies (cyclically) between its ideal bucket and `next`
+				if (((next - ideal) & mask()) >= ((next - bucket) & mask()))
+				{
+					m_buckets[bucket] = m_buckets[next];
+					bucket = next;
+				}
+			}
+			m_buckets[bucket] = 0;
+
+			m_slots[slot] = {};
+			m_free_slots.push_back(slot);
+			--m_size;
+			next_generation();
+		}
+
+		size_t erase(symbol name)
+		{
+			if (auto it = find(name); it != end())
+			{
+				erase(it);
+				return 1;
+			}
+			return 0;
+		}
+
+		void clear() noexcept
+		{
+			if (m_size == 0)
+				return;
+			m_slots.clear();
+			m_free_slots.clear();
+			std::fill(m_buckets.begin(), m_buckets.end(), 0);
+			m_size = 0;
+			next_generation();
+		}
+
+	private:
+
+		/// A deque never moves its elements, so references to values stay valid
+		std::deque<entry> m_slots;
+		std::vector<uint32_t> m_free_slots;
+		/// Slot index + 1 of the variable in each bucket, or 0 if the bucket is empty; the size is always a power of 2
+		std::vector<uint32_t> m_buckets;
+		size_t m_size = 0;
+		uint64_t m_generation = 0;
+		std::atomic<uint64_t>* m_shared_generation = nullptr;
+
+		void next_generation() noexcept
+		{
+			++m_generation;
+			if (m_shared_generation)
+				m_shared_generation->fetch_add(1, std::memory_order_relaxed);
+		}
+
+		size_t mask() const noexcept { return m_buckets.size() - 1; }
+		/// Multiplicative hashing; symbols are small consecutive integers, so they have to be spread out
+		size_t bucket_of(symbol name) const noexcept { return size_t(uint32_t(name.id * 0x9E3779B9u)) & mask(); }
+		size_t next_bucket(size_t bucket) const noexcept { return (bucket + 1) & mask(); }
+
+		iterator iterator_at(uint32_t slot) noexcept { return { m_slots.begin() + slot, m_slots.end() }; }
+
+		void insert_bucket(symbol name, uint32_t slot) noexcept
+		{
+			auto bucket = bucket_of(name);
+			while (m_buckets[bucket])
+				bucket = next_bucket(bucket);
+			m_buckets[bucket] = slot + 1;
+		}
+
+		void rehash(size_t bucket_count)
+		{
+			m_buckets.assign(bucket_count, 0);
+			for (uint32_t slot = 0; slot < m_slots.size(); ++slot)
+			{
+				if (m_slots[slot].first)
+					insert_bucket(m_slots[slot].first, slot);
+			}
+		}
+	};
+}
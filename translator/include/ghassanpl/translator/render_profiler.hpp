@@ -0,0 +1,186 @@
+#pragma once
+
+#include "detail/output_sink.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace translator
+{
+	/// A histogram of latencies whose buckets are exponentially spaced, each power of 2 split into `sub_buckets` linear ones
+	/// (as in HDR histograms), so that any latency from 1ns to about 36 minutes is recorded with a relative error of at most
+	/// 1/`sub_buckets`, in a fixed amount of memory
+	struct latency_histogram
+	{
+		static constexpr unsigned sub_bucket_bits = 3;
+		static constexpr uint64_t sub_buckets = uint64_t(1) << sub_bucket_bits;
+		/// Latencies of 2^(max_exponent + 1) nanoseconds or more are recorded in the last bucket
+		static constexpr unsigned max_exponent = 40;
+		static constexpr size_t bucket_count = (max_exponent - sub_bucket_bits + 2) * sub_buckets;
+
+		void record(std::chrono::nanoseconds latency) noexcept;
+		void merge(latency_histogram const& other) noexcept;
+
+		uint64_t count() const noexcept { return m_count; }
+		std::chrono::nanoseconds min() const noexcept { return std::chrono::nanoseconds(m_count ? m_min : 0); }
+		std::chrono::nanoseconds max() const noexcept { return std::chrono::nanoseconds(m_max); }
+
+		/// The latency that `fraction` (0 to 1) of the recorded latencies are at most, i.e. the upper bound of the bucket it falls into
+		/// (but no more than `max()`); e.g. `percentile(0.99)` is the 99th percentile
+		std::chrono::nanoseconds percentile(double fraction) const noexcept;
+
+		static size_t bucket_of(uint64_t nanoseconds) noexcept;
+		/// The largest latency (in nanoseconds) recorded in `bucket`
+		static uint64_t bucket_upper_bound(size_t bucket) noexcept;
+
+	private:
+
+		std::array<uint64_t, bucket_count> m_counts{};
+		uint64_t m_count = 0;
+		uint64_t m_min = 0;
+		uint64_t m_max = 0;
+	};
+
+	/// The renders of one template recorded by a `render_profiler`
+	struct template_stats
+	{
+		/// The source of the template (for `context::interpolate`), its `json` representation (for `context::interpolate_parsed`),
+		/// or its message id (for catalogs)
+		std::string name;
+		uint64_t renders = 0;
+		std::chrono::nanoseconds total_time{};
+		latency_histogram latency;
+		/// Output sizes in bytes (including output that did not fit in a buffer sink)
+		uint64_t total_output_size = 0;
+		size_t min_output_size = 0;
+		size_t max_output_size = 0;
+
+		std::chrono::nanoseconds mean_latency() const noexcept { return renders ? total_time / std::chrono::nanoseconds::rep(renders) : std::chrono::nanoseconds{}; }
+		double mean_output_size() const noexcept { return renders ? double(total_output_size) / double(renders) : 0.0; }
+
+		void record(std::chrono::nanoseconds latency, size_t output_size) noexcept;
+		void merge(template_stats const& other) noexcept;
+	};
+
+	namespace detail
+	{
+		/// The renders recorded by one thread; see `render_profiler`
+		struct thread_template_stats
+		{
+			/// Only contended when the stats are read or reset
+			std::mutex mutex;
+			std::map<std::string, template_stats, std::less<>> by_name;
+			/// Templates recorded by hash, e.g. of their parsed form, so that they only have to be named once
+			std::unordered_map<size_t, template_stats> by_hash;
+			/// Cleared when the thread that records into these exits, so that another thread can take them over
+			std::atomic<bool> in_use{ true };
+			/// Set when the profiler is destroyed
+			std::atomic<bool> orphaned{ false };
+
+			size_t template_count() const noexcept { return by_name.size() + by_hash.size(); }
+		};
+	}
+
+	/// Records the render counts, latencies and output sizes of the templates rendered in the contexts it is attached to
+	/// (see `context::set_render_profiler`), so that the hot and slow templates can be found, e.g. to decide which ones
+	/// should be precompiled or have their results cached.
+	///
+	/// Templates are identified by their names (see `template_stats::name`); renders that fail are recorded too.
+	/// Renders from any number of threads can be recorded at once: each thread records into stats of its own (taking a lock
+	/// that is only contended while the stats are being read), which are merged when they are read.
+	struct render_profiler
+	{
+		/// Renders of templates after the first `max_templates` (in each thread) are recorded under `other_templates_name`,
+		/// so that rendering many one-off templates does not use up memory
+		explicit render_profiler(size_t max_templates = 10000) noexcept;
+		~render_profiler();
+
+		render_profiler(render_profiler const&) = delete;
+		render_profiler& operator=(render_profiler const&) = delete;
+
+		static constexpr std::string_view other_templates_name = "<other templates>";
+
+		void record(std::string_view name, std::chrono::nanoseconds latency, size_t output_size);
+		/// Records a render of the template identified by `hash`, which is named `name` if this thread has not recorded it before
+		void record(size_t hash, std::string name, std::chrono::nanoseconds latency, size_t output_size);
+
+		/// Calls `render`, which writes to `sink`, and records it under `name`, even if it throws
+		template <typename RENDER>
+		void measure(std::string_view name, output_sink& sink, RENDER&& render)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			const auto output_start = sink.size();
+			try
+			{
+				render();
+			}
+			catch (...)
+			{
+				record(name, std::chrono::steady_clock::now() - start, sink.size() - output_start);
+				throw;
+			}
+			record(name, std::chrono::steady_clock::now() - start, sink.size() - output_start);
+		}
+
+		/// Like `measure`, but identifies the template by `hash`, and only calls `name` (before `render`) to name it
+		/// if this thread has not recorded it before
+		template <typename NAME, typename RENDER>
+		void measure(size_t hash, NAME&& name, output_sink& sink, RENDER&& render)
+		{
+			std::string new_name;
+			if (!knows(hash))
+				new_name = name();
+
+			const auto start = std::chrono::steady_clock::now();
+			const auto output_start = sink.size();
+			try
+			{
+				render();
+			}
+			catch (...)
+			{
+				record(hash, std::move(new_name), std::chrono::steady_clock::now() - start, sink.size() - output_start);
+				throw;
+			}
+			record(hash, std::move(new_name), std::chrono::steady_clock::now() - start, sink.size() - output_start);
+		}
+
+		enum class ranking
+		{
+			total_time,
+			renders,
+			p99_latency,
+			mean_output_size,
+		};
+
+		std::vector<template_stats> snapshot() const;
+		/// The `count` templates that rank highest by `by`
+		std::vector<template_stats> top(size_t count, ranking by = ranking::total_time) const;
+		/// A table of the `count` templates that rank highest by `by`, with their render counts, latency percentiles and output sizes
+		std::string report(size_t count = 10, ranking by = ranking::total_time) const;
+
+		size_t template_count() const;
+		void reset();
+
+	private:
+
+		/// Whether this thread has recorded the template identified by `hash`
+		bool knows(size_t hash);
+		detail::thread_template_stats& local_stats();
+		/// The stats of this thread that templates beyond the limit are recorded in
+		template_stats& other_templates(detail::thread_template_stats& stats);
+
+		/// Identifies this profiler in the per-thread caches of `local_stats`, as another one may later be created at the same address
+		uint64_t m_id = 0;
+		/// Guards `m_threads` (but not the stats in it)
+		mutable std::mutex m_threads_mutex;
+		std::vector<std::shared_ptr<detail::thread_template_stats>> m_threads;
+		size_t m_max_templates = 0;
+	};
+}
@@ -3,4 +3,8 @@
 #include "translator_capi.h"
 #ifdef __cplusplus
 #include "translator.hpp"
+#include "core_lib.hpp"
+#include "catalog.hpp"
+#include "batch.hpp"
+#include "render_profiler.hpp"
 #endif
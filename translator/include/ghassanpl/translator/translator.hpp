@@ -2,51 +2,178 @@
 
 #include "translator_capi.h"
 #include "detail/functions.h"
+#include "detail/native_function.h"
+#include "detail/compiled_template.h"
+#include "detail/parsed_template.h"
+#include "detail/output_sink.h"
+#include "detail/variable_map.h"
+#include <atomic>
+#include <mutex>
 #include <optional>
+#include <unordered_map>
 #include <vector>
 
 namespace translator
 {
+	struct render_profiler;
+
 	/// TODO: Should we use tl::expected and never throw exceptions?
 	///		Instead of `binary` support, we'd have to use `json::value_t::binary` for errors (We could also use the first 1/2 bytes of binary to store type id)
 	///		This would make the C api nice
 	///		OR we could use JSON objects for additional types :P
 
+	/// An error recorded while evaluating with `options.errors_as_values` set
+	struct evaluation_error
+	{
+		std::string message;
+		/// The innermost call being evaluated when the error was reported, as by `context::describe_call`
+		/// (if `options.maintain_call_stack` is set)
+		std::string call;
+		/// The position of that call (or of the innermost call around it whose position is known), if any (see `context::call_span`)
+		std::optional<source_span> span;
+	};
+
+	/// The result of `context::interpolate_with_errors`
+	struct render_result
+	{
+		/// Error values are rendered as nothing, so this is the output of everything that did not fail
+		std::string output;
+		std::vector<evaluation_error> errors;
+
+		bool ok() const noexcept { return errors.empty(); }
+	};
+
 	struct context : translator_context
 	{
 		explicit context(context* parent) noexcept;
 		context() noexcept;
+		/// Flushes the function profiles of a child context into its root (see `flush_function_profiles`)
+		~context();
 		
 		context* parent() const noexcept { return (context*)parent_context; }
-		context const* get_root_context() const noexcept { return parent() ? parent()->get_root_context() : this; }
+		context const* get_root_context() const noexcept { return m_root; }
+
+		/// The symbol table shared by this context and all its children (owned by the root context)
+		symbol_table& symbols() const noexcept { return get_root_context()->m_symbols; }
 		
 		/// ////////////////////////////////////////////////////////////////////////// ///
 		/// Main API
 		/// ////////////////////////////////////////////////////////////////////////// ///
 
 		std::string interpolate(std::string_view str);
+		/// Like `interpolate`, but writes the output to `sink` as it goes
+		void interpolate_to(output_sink& sink, std::string_view str);
 		
 		/// TODO: Add these functions to the C api
-		json parse(std::string_view str) const;
-		json parse_call(std::string_view str) const;
+		/// If `spans` is given, the spans of the calls and atoms of the result are added to it (see `source_map`)
+		json parse(std::string_view str, source_map* spans = nullptr) const;
+		/// The spans of the elements of the call are added to `spans` (the call itself is returned by value, so its address is not known)
+		json parse_call(std::string_view str, source_map* spans = nullptr) const;
 		std::string interpolate_parsed(json const& parsed);
 		std::string interpolate_parsed(json&& parsed);
+		void interpolate_parsed_to(output_sink& sink, json const& parsed);
+		void interpolate_parsed_to(output_sink& sink, json&& parsed);
+		/// Like `interpolate_parsed`, but errors and the call stack refer to the positions of calls in `spans` (see `call_span`)
+		std::string interpolate_parsed(json const& parsed, source_map const& spans);
+		void interpolate_parsed_to(output_sink& sink, json const& parsed, source_map const& spans);
+
+		/// Like `parse`, but produces a `tagged_value` array of text strings and calls, with words interned as symbols.
+		/// If `arena` is given, the whole tree is allocated from it (see `tagged_value`), and `arena` has to outlive it.
+		/// If `view_source` is set, text that does not need unescaping refers to `str` instead of being copied, and `str` has to outlive the tree.
+		tagged_value parse_value(std::string_view str, std::pmr::memory_resource* arena = nullptr, bool view_source = false, source_map* spans = nullptr) const;
+		/// Like `parse_value`, but allocates the tree (and a copy of `str` that its text refers to) from an arena owned by the result,
+		/// which gets its memory from `upstream`. If `options.track_source_spans` is set, the template keeps the spans of its nodes.
+		parsed_template parse_template(std::string_view str, std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) const;
+
+		/// Lowers the result of `parse` or `parse_value` into a `compiled_template`, resolving its function calls in this context.
+		/// If `spans` (of `parsed`) is given, the compiled calls keep their positions for the call stack (if `options.maintain_call_stack` is set).
+		compiled_template compile(json const& parsed, source_map const* spans = nullptr) const;
+		compiled_template compile(tagged_value const& parsed, source_map const* spans = nullptr) const;
+		compiled_template compile(parsed_template const& parsed) const { return compile(parsed.root(), &parsed.spans()); }
+		/// Renders a compiled template. `compiled` has to be compiled in this context or one of its parents; if functions were bound there since
+		/// (see `is_current`), it is recompiled from its source the first time it is rendered, and the result is kept (in `compiled`) and rendered
+		/// instead, until functions are bound again.
+		std::string interpolate_compiled(compiled_template const& compiled);
+		void interpolate_compiled_to(output_sink& sink, compiled_template const& compiled);
+		/// Whether `compiled` was compiled in this context, and no functions were bound in it (or its parents) since
+		bool is_current(compiled_template const& compiled) const noexcept { return compiled.linked_context == this && compiled.bind_generation == bind_generation(); }
+
+		/// Evaluates, in place, the calls of a parsed template to pure functions (see `function_flag::pure`) whose arguments are all
+		/// literals (including the results of calls folded before them), and merges the text around top-level calls it replaces.
+		/// Calls that report an error (by throwing) are left as they are. Returns the number of calls replaced.
+		///
+		/// The results are not updated if the functions are rebound afterwards, so templates should be folded after binding all functions.
+		size_t fold_constants(json& parsed);
+		/// If the tree was allocated from an arena, it has to be given as `arena`, so that new values are allocated from it too.
+		/// Only calls that return scalars or strings are replaced, as other values cannot be allocated from an arena.
+		/// If `spans` (of `parsed`) is given, the spans of the calls that are left follow them to where they are moved, and those of
+		/// the nodes that are folded away are removed.
+		size_t fold_constants(tagged_value& parsed, std::pmr::memory_resource* arena = nullptr, source_map* spans = nullptr);
+		size_t fold_constants(parsed_template& parsed);
+
+		/// Symbols of the names of all variables the result of `parse` or `parse_value` can reference (i.e. all words and strings in its calls
+		/// that start with `options.var_symbol`), without duplicates; variables accessed by name by functions are not included.
+		/// Compiled templates store theirs in `compiled_template::variables`.
+		std::vector<symbol> referenced_variables(json const& parsed) const;
+		std::vector<symbol> referenced_variables(tagged_value const& parsed) const;
 
 		using error_handler_func = std::function<std::string(context const&, std::string_view)>;
 
 		error_handler_func& error_handler() { return m_error_handler; }
 
+		/// With `options.errors_as_values` set, errors are not thrown (or passed to the error handler), but recorded here, and the calls
+		/// that failed evaluate to error values (see `is_error_value`). Error values propagate through operators and native functions,
+		/// are false in conditions, and are rendered as nothing. The list is cleared at the start of each (outermost) render.
+		/// Frozen contexts do not record errors (e.g. of attempts to modify them), but throw them or pass them to the error handler.
+		std::vector<evaluation_error> const& errors() const noexcept { return m_errors; }
+		void clear_errors() noexcept { m_errors.clear(); }
+
+		/// Discards what a render that threw may have left behind (its call stack and value stack frames, a pending scope terminator
+		/// and its recorded errors), so that the context can be reused; must not be called during a render
+		void reset_evaluation_state() noexcept;
+
+		/// Like `interpolate`, but returns the errors of the render along with its output; should be used with `options.errors_as_values` set,
+		/// as otherwise the first error is thrown (or handled by the error handler) instead
+		render_result interpolate_with_errors(std::string_view str);
+
+		/// Renders by the `interpolate*` functions (except `interpolate_compiled`) and by catalogs are recorded in `profiler` (see `render_profiler`),
+		/// which is used by the children of this context as well, unless they have their own. The profiler has to outlive the context; null detaches it.
+		void set_render_profiler(translator::render_profiler* profiler);
+		/// The profiler of this context or its nearest parent that has one, if any
+		translator::render_profiler* get_render_profiler() const noexcept;
+
+		/// ////////////////////////////////////////////////////////////////////////// ///
+		/// Freezing
+		/// ////////////////////////////////////////////////////////////////////////// ///
+
+		/// Makes the functions and variables of this context and all its parents read-only, so that any number of threads
+		/// can evaluate templates at the same time, each in its own child context, which holds all the mutable evaluation state
+		/// (call stack, value stack, function cache and its own variables). Frozen contexts cannot be unfrozen.
+		///
+		/// Has to be called before the other threads start using the contexts. Afterwards, binding functions in a frozen context,
+		/// setting its variables, or evaluating anything in it directly is reported as an error; setting a variable of a frozen
+		/// parent from a child context creates a local variable in the child instead. The symbol table is made thread-safe as well.
+		void freeze() noexcept;
+		bool frozen() const noexcept { return m_frozen; }
+
 		/// ////////////////////////////////////////////////////////////////////////// ///
 		/// Variables
 		/// ////////////////////////////////////////////////////////////////////////// ///
 		
+		/// Variables are keyed by the symbols of their names (see `symbols()`), and stored in a flat hash table (see `translator::variable_map`)
+		using variable_map = translator::variable_map;
+
 		auto& context_variables() { return m_context_variables; }
 		auto& own_variables() { return m_context_variables; }
 
-		auto find_variable(std::string_view name) -> std::pair<context*, std::map<std::string, json, std::less<>>::iterator>;
+		auto find_variable(std::string_view name) -> std::pair<context*, variable_map::iterator>;
+		/// Variables of this context are looked up directly; those of its parents through an index that is cleared
+		/// whenever a variable is added to or removed from any of them, so deeply nested contexts do not walk the whole chain
+		auto find_variable(symbol name) -> std::pair<context*, variable_map::iterator>;
 
 		/// If the variable does not exist, will call the function set via unknown_var_value_getter
 		json user_var(std::string_view name);
+		json user_var(symbol name);
 
 		/// Will return reference to the variable value if it exists, otherwise will return the provided value
 		json const& user_var(std::string_view name, json const& val_if_not_found);
@@ -58,6 +185,15 @@ namespace translator
 		/// Gets a mutable reference to the callback that will be called when a variable is not found
 		var_value_getter_func& unknown_var_value_getter() { return m_unknown_var_value_getter; }
 
+		/// Called with the names of the variables that are referenced by a template (see `referenced_variables`) but not set,
+		/// once before it is rendered; should write the value of each `names[i]` to `values[i]`. Values left discarded
+		/// (`json::value_t::discarded`) are still retrieved through `unknown_var_value_getter` when needed.
+		/// The values are only kept for that render.
+		///
+		/// If this is set, `interpolate` parses the whole template before rendering any of it.
+		using var_batch_getter_func = std::function<void(context&, std::vector<std::string_view> const& names, std::vector<json>& values)>;
+		var_batch_getter_func& unknown_vars_batch_getter() { return m_unknown_vars_batch_getter; }
+
 		/// ////////////////////////////////////////////////////////////////////////// ///
 		/// Functions
 		/// ////////////////////////////////////////////////////////////////////////// ///
@@ -67,9 +203,30 @@ namespace translator
 		auto& context_functions() const { return m_functions_by_sig; }
 		auto& own_functions() const { return m_functions_by_sig; }
 
-		defined_function const* bind_function(std::string_view signature, eval_func func
+		defined_function const* bind_function(std::string_view signature, eval_func func, function_flags flags = {}
 			///, std::source_location loc = std::source_location::current()
 		);
+		/// Binds a function that takes the (unevaluated) arguments of each call in place, instead of in a new vector (see `native_eval_func`);
+		/// they are stored in the call itself, or on the stack for calls from compiled templates with at most 8 arguments
+		defined_function const* bind_function(std::string_view signature, native_eval_func func, function_flags flags = {});
+		/// Binds a C++ function (or lambda) that takes native types (see `detail::native_arg`) instead of unevaluated `json` arguments,
+		/// e.g. `bind_simple_function("arg + arg", [](int a, int b) { return a + b; })`. The arguments of each call are evaluated,
+		/// checked and converted where they are, and the result is converted to `json` once (`void` functions return null).
+		/// The function can also take a `context&` as its first parameter.
+		template <typename FUNC>
+		defined_function const* bind_simple_function(std::string_view signature, FUNC func, function_flags flags = {})
+		{
+			using traits = detail::callable_traits<FUNC>;
+			return bind_function(signature, [func = std::move(func)](context& ctx, argument_span args) mutable -> json {
+				return ctx.call_simple_function<typename traits::result_type>(func, args.data(), args.size(), typename traits::argument_types{});
+			}, flags);
+		}
+
+		/// Makes compiled templates execute calls to `func` (a function bound in this context) as the intrinsic operation `op`
+		/// instead of calling it; `func` has to implement the same semantics, as it is still called by the interpreter.
+		/// Rebinding the function (or binding one with the same signature in a child context) overrides the intrinsic.
+		void set_intrinsic(defined_function const* func, intrinsic_op op);
+
 		/// TODO: void unbind_function(defined_function const*);
 		/// TODO: void unbind_function(std::string_view signature);
 		/// TODO: void rebind_function(defined_function const*, eval_func func);
@@ -78,14 +235,48 @@ namespace translator
 		/// TODO: void unbind_functions(std::span<defined_function const*>);
 
 		std::vector<defined_function const*> find_functions(std::vector<json> const& arguments, bool only_in_local = false) const;
+
+		/// Incremented every time a function is bound in this context or any of its parents;
+		/// used to invalidate cached function resolutions
+		uint64_t bind_generation() const noexcept;
+
+		struct function_cache_stats_t
+		{
+			size_t hits = 0;
+			size_t misses = 0;
+		};
+
+		/// Hit/miss counters of the dispatch index, which caches the function each call shape (the kind of call and its parameter names)
+		/// resolves to in this context; not counted in frozen contexts, which do not use it
+		function_cache_stats_t const& function_cache_stats() const noexcept { return m_function_cache_stats; }
+		/// Clears the dispatch index and its counters
+		void clear_function_cache();
+
+		/// The calls to functions made in this context while `options.profile_functions` was set, and (in the root context) those flushed
+		/// into it by its children, merged by signature and sorted by exclusive time, most expensive first.
+		/// Calls that compiled templates execute as intrinsics (see `set_intrinsic`) are not counted.
+		std::vector<function_profile> function_profiles() const;
+		/// Adds the function profiles of this child context to those of the root context and clears them; done when a child context is
+		/// destroyed, so per-request contexts do not lose their profiles. Can be called from many threads at once (for different contexts).
+		/// Does nothing while a profiled call is running.
+		void flush_function_profiles();
+		/// Clears the function profiles of this context (and those flushed into it, in the root context); does nothing while a profiled call is running
+		void reset_function_profiles();
 		/// TODO: std::vector<defined_function const*> find_functions_by_signature(std::string_view signature, bool only_in_local = false) const;
 		/// TODO: std::vector<defined_function const*> find_closest(std::vector<json> const& arguments, bool only_in_local = false) const;
 		
 		eval_func& unknown_func_handler() { return m_unknown_func_handler.func; }
 		auto& json_value_to_string_func() { return m_json_value_to_str_func; }
 		static std::string default_json_value_to_str_func(context const& c, json const& j);
+		/// Used instead of `json_value_to_string_func` by the `interpolate_*` functions, so that values can be written
+		/// to the output without building temporary strings. If not set, `json_value_to_string_func` is used, unless it is the default one,
+		/// in which case `default_json_value_append_func` is.
+		auto& json_value_append_func() { return m_json_value_append_func; }
+		static void default_json_value_append_func(context const& c, json const& j, output_sink& sink);
 
 		std::string report_error(std::string_view error) const;
+		/// Like `report_error`, but returns an error value if `options.errors_as_values` is set; used by calls that fail
+		json error_value(std::string_view error) const;
 
 		/// ////////////////////////////////////////////////////////////////////////// ///
 		/// Functions past here are for
@@ -98,6 +289,34 @@ namespace translator
 		/// handler functions
 		/// ////////////////////////////////////////////////////////////////////////// ///
 
+		/// Thrown (with `options.errors_as_values` set) by the `assert_*` and `eval_arg*` helpers to abort the function being called,
+		/// whose call then evaluates to `error`; also thrown (with a null `error`) when an argument was cut short by a pending scope terminator
+		struct e_error_value {
+			json error;
+		};
+
+		/// Control flow that functions can start with `terminate_scope`
+		enum class scope_terminator : uint8_t
+		{
+			none,
+			break_loop,
+			continue_loop,
+			return_value,
+		};
+
+		/// Makes the evaluation return (without throwing) to the nearest function that handles `kind`: until it is handled, `eval` returns null
+		/// immediately, and functions whose arguments it cut short return null. Loops should call `end_loop_iteration` after evaluating
+		/// their body, and functions defined by scripts `take_return_value`. Terminators that reach the top level of a template are reported as errors.
+		/// \param result The value to return, for `scope_terminator::return_value`
+		void terminate_scope(scope_terminator kind, json result = nullptr);
+		scope_terminator pending_terminator() const noexcept { return m_pending_terminator; }
+
+		/// Handles a pending `continue_loop` or `break_loop`; returns true if the loop should stop (after `break_loop`, or while a `return_value` is pending)
+		bool end_loop_iteration() noexcept;
+		/// Handles a pending `return_value` and returns its result; returns `result` if there is none
+		json take_return_value(json result);
+
+		/// The exception-based equivalent of `terminate_scope`; functions that catch these pay for unwinding each time
 		struct e_scope_terminator {
 			json result = json::value_t::discarded;
 			virtual std::string type() const noexcept = 0;
@@ -106,6 +325,7 @@ namespace translator
 
 		/// Reports and throws error if there aren't exactly `arg_count` arguments
 		void assert_args(std::vector<json> const& args, size_t arg_count) const;
+		void assert_args(argument_span args, size_t arg_count) const;
 
 		/// Reports and throws error if there aren't between `min_args` and `max_args` arguments
 		void assert_args(std::vector<json> const& args, size_t min_args, size_t max_args) const;
@@ -188,56 +408,318 @@ namespace translator
 		/// Debugging
 		/// ////////////////////////////////////////////////////////////////////////// ///
 
+		/// Frames only refer to their calls, which are formatted by `describe_call` when needed
+		/// (the calls are only recorded if `options.call_stack_store_call_string` is set)
 		struct call_stack_element
 		{
 			defined_function const* actual_function = nullptr;
-			std::string debug_call_sig;
+			/// The unevaluated call, for calls evaluated from a `json const&` (which stays unchanged while the function runs)
+			json const* call = nullptr;
+			/// The call, for calls made by compiled templates
+			tagged_value const* compiled_call = nullptr;
+			/// The position of the call, for calls made by templates compiled with spans
+			source_span const* span = nullptr;
 		};
 		auto& call_stack() const noexcept { return m_call_stack; }
 
+		/// The call of `frame` as a string (e.g. `[.kills == 1]`); calls whose unevaluated arguments were handed over to their function
+		/// (i.e. those evaluated by `eval(json&&)`) are described by the signature of the function instead
+		std::string describe_call(call_stack_element const& frame) const;
+		/// The position of the call of `frame` in the source of its template, if the template was parsed with spans (see `source_map`)
+		/// and is rendered with them (by `interpolate_parsed` with a `source_map`, or as a template compiled with spans), or by `interpolate`
+		/// with `options.track_source_spans` set
+		std::optional<source_span> call_span(call_stack_element const& frame) const;
+
 		/// ////////////////////////////////////////////////////////////////////////// ///
 		/// Parsing; used by internal functions, but provided here for convenience
 		/// ////////////////////////////////////////////////////////////////////////// ///
 		
 		auto consume_atom(std::string_view& sexp_str) const -> nlohmann::json;
-		auto consume_list(std::string_view& sexp_str, bool require_closing_delim = true) const -> nlohmann::json;
-		auto consume_value(std::string_view& sexp_str) const -> nlohmann::json;
+		/// If `spans` is given, the spans of the elements read are recorded in it
+		auto consume_list(std::string_view& sexp_str, bool require_closing_delim = true, detail::span_recorder* spans = nullptr) const -> nlohmann::json;
+		auto consume_value(std::string_view& sexp_str, detail::span_recorder* spans = nullptr) const -> nlohmann::json;
 		auto consume_c_string(std::string_view& strv) const -> std::string;
 
 		std::string value_to_string(json const& j) const;
 		std::string array_to_string(std::vector<json> const& arguments) const;
+		/// Appends the string representation of `j` (as by `value_to_string`) to `sink`
+		void append_value(output_sink& sink, json const& j) const;
 
 	private:
 
-		std::map<std::string, json, std::less<>> m_context_variables;
+		variable_map m_context_variables;
+
+		/// Symbol id → the context and variable that `find_variable` found in the parents of this context (null if none);
+		/// only used if this context has more than one parent
+		std::unordered_map<uint32_t, std::pair<context*, variable_map::iterator>> m_variable_index;
+		uint64_t m_variable_index_generation = 0;
+
+		context* m_root = this;
+		/// Set when a child context is created while this one is not frozen; from then on, the changes of this context are counted in
+		/// the epochs of the root context
+		bool m_has_children = false;
+		/// Only used in root contexts: incremented whenever a function is bound in, or a variable added to or erased from, a context that has
+		/// children, so that contexts can tell whether any of their parents changed (see `dispatch` and `find_variable`) with a single load,
+		/// instead of summing the generations of all of them
+		std::atomic<uint64_t> m_bind_epoch{ 0 };
+		std::atomic<uint64_t> m_variable_epoch{ 0 };
+		/// Increments `m_bind_generation`, and the bind epoch of the root context if needed
+		void next_bind_generation() noexcept;
+
+		/// Only used in root contexts; see `symbols()`
+		mutable symbol_table m_symbols;
 
 		defined_function m_unknown_func_handler;
 		var_value_getter_func m_unknown_var_value_getter;
+
+		var_batch_getter_func m_unknown_vars_batch_getter;
+
+		/// Values returned by `m_unknown_vars_batch_getter` for the current render, and by `m_unknown_var_value_getter` during it
+		/// (if `options.memoize_unknown_vars` is set)
+		std::map<std::string, json, std::less<>> m_unknown_var_memo;
+		/// Number of `interpolate*` calls currently running in this context; the memo is cleared when the outermost one returns
+		size_t m_render_depth = 0;
+
+		struct render_scope
+		{
+			explicit render_scope(context& ctx) noexcept;
+			~render_scope();
+			render_scope(render_scope const&) = delete;
+			render_scope& operator=(render_scope const&) = delete;
+		private:
+			context* m_context;
+		};
+
+		/// Calls `m_unknown_var_value_getter`, or returns its memoized result
+		json unknown_var(std::string_view name);
+		/// Retrieves the variables of `names` that are not set through `m_unknown_vars_batch_getter` into the memo; has to be called in a `render_scope`
+		void prefetch_unknown_vars(std::vector<symbol> const& names);
+		std::vector<std::string_view> m_prefetch_names;
+		std::vector<json> m_prefetch_values;
 		error_handler_func m_error_handler;
+		mutable std::vector<evaluation_error> m_errors;
+
+		scope_terminator m_pending_terminator = scope_terminator::none;
+		json m_terminator_result;
+		/// Reports (and clears) a terminator that was not handled by any function
+		std::string report_unhandled_terminator();
+		/// Throws `e_error_value` for the error value of `error`, or the result of `report_error` as `std::runtime_error`
+		[[noreturn]] void throw_error(std::string_view error) const;
 
 		std::function<std::string(context const&, json const&)> m_json_value_to_str_func;
+		std::function<void(context const&, json const&, output_sink&)> m_json_value_append_func;
 
 		std::vector<call_stack_element> m_call_stack;
+		/// The spans of the template being rendered by `interpolate_parsed`, if it was given them
+		source_map const* m_source_map = nullptr;
+		translator::render_profiler* m_render_profiler = nullptr;
+
+		/// The `interpolate*` functions, without being recorded by the render profiler
+		void render_source(output_sink& sink, std::string_view str);
+		void render_parsed(output_sink& sink, json const& parsed);
+		void render_parsed(output_sink& sink, json&& parsed);
+		void render_parsed(output_sink& sink, json const& parsed, source_map const& spans);
+		/// `compiled` recompiled in this context (in which it was compiled, but is no longer current), reusing the last recompilation if it still is
+		std::shared_ptr<compiled_template const> relink(compiled_template const& compiled) const;
 		/// TODO: If we don't want to maintain a call stack, we can also just keep a single "m_current_call" that we adjust
 		/// based on the calls to `call()`.
 
-		json call(defined_function const* func, std::vector<json> arguments, std::string call_frame_desc);
+		/// `frame` is pushed onto the call stack (with `actual_function` set to `func`) if it is maintained
+		json call(defined_function const* func, std::vector<json> arguments, call_stack_element frame);
+		/// Calls `func` with the `arg_count` values at `arguments`, which it may move from
+		json call(defined_function const* func, json* arguments, size_t arg_count, call_stack_element frame);
+		/// `call_node` is the call `args` were copied from, if it stays unchanged during the call
+		json eval_list(std::vector<json> args, json const* call_node);
+		call_stack_element frame_for(json const* call_node) const noexcept
+		{
+			call_stack_element frame;
+			if (options.call_stack_store_call_string || m_source_map)
+				frame.call = call_node;
+			return frame;
+		}
+
+		/// Report and throw errors like `assert_args` and `assert_arg`
+		void check_native_arg_count(size_t arg_count, size_t param_count) const;
+		[[noreturn]] void report_native_arg_error(size_t arg_num, std::string_view expected_type, json const& value) const;
+
+		template <typename RESULT, typename FUNC>
+		json call_simple_function(FUNC& func, json* arguments, size_t arg_count, detail::type_list<>)
+		{
+			return invoke_simple_function<RESULT>(func, arguments, arg_count, detail::type_list<>{}, std::index_sequence<>{});
+		}
+
+		template <typename RESULT, typename FUNC, typename FIRST, typename... ARGS>
+		json call_simple_function(FUNC& func, json* arguments, size_t arg_count, detail::type_list<FIRST, ARGS...>)
+		{
+			if constexpr (detail::is_context_param<FIRST>)
+			{
+				auto with_context = [&](auto&&... args) -> decltype(auto) { return func(*this, std::forward<decltype(args)>(args)...); };
+				return invoke_simple_function<RESULT>(with_context, arguments, arg_count, detail::type_list<ARGS...>{}, std::index_sequence_for<ARGS...>{});
+			}
+			else
+				return invoke_simple_function<RESULT>(func, arguments, arg_count, detail::type_list<FIRST, ARGS...>{}, std::index_sequence_for<FIRST, ARGS...>{});
+		}
+
+		template <typename RESULT, typename FUNC, typename... ARGS, size_t... INDICES>
+		json invoke_simple_function(FUNC& func, json* arguments, size_t arg_count, detail::type_list<ARGS...>, std::index_sequence<INDICES...>)
+		{
+			check_native_arg_count(arg_count, sizeof...(ARGS));
+			/// Left to right, like `eval_args`; the first error value stops the evaluation and becomes the result
+			if (!(evaluate_native_arg<std::decay_t<ARGS>>(arguments[INDICES], INDICES) && ...))
+			{
+				const auto error = std::find_if(arguments, arguments + arg_count, [](json const& arg) { return is_error_value(arg); });
+				return error != arguments + arg_count ? std::move(*error) : json{};
+			}
+			if constexpr (std::is_void_v<RESULT>)
+			{
+				func(detail::native_arg<std::decay_t<ARGS>>::get(arguments[INDICES])...);
+				return nullptr;
+			}
+			else
+				return json(func(detail::native_arg<std::decay_t<ARGS>>::get(arguments[INDICES])...));
+		}
+
+		/// Returns false if the argument evaluated to an error value, or started a scope terminator
+		template <typename T>
+		bool evaluate_native_arg(json& argument, size_t arg_num)
+		{
+			argument = eval(std::move(argument));
+			if (m_pending_terminator != scope_terminator::none)
+				return false;
+			/// Errors propagate through functions, instead of being reported again as arguments of the wrong type
+			if (!std::is_same_v<T, json> && is_error_value(argument))
+				return false;
+			if (!detail::native_arg<T>::accepts(argument))
+				report_native_arg_error(arg_num, detail::native_arg<T>::type_name, argument);
+			return true;
+		}
+
+		/// Value stack used by `interpolate_compiled`; shared between nested runs, each of which only uses the values above its base
+		std::vector<json> m_value_stack;
+
+		void compile_call(compiled_template& result, tagged_value const& call, size_t& stack_size, source_map const* spans) const;
+		void compile_argument(compiled_template& result, tagged_value const& arg, size_t& stack_size, source_map const* spans) const;
+		bool compile_intrinsic(compiled_template& result, intrinsic_op op, std::vector<tagged_value const*> const& args, size_t& stack_size, source_map const* spans) const;
+
+		/// Evaluates `call` if it is a call to a pure function with only literal arguments; see `fold_constants`
+		bool try_fold_call(json const& call, json& result);
+		/// Only converts `call` to `json` once all its arguments are literals, so folding a tree converts each call at most once
+		bool try_fold_call(tagged_value const& call, json& result);
+		/// Evaluates `call`, which `try_fold_call` checked can be folded
+		bool eval_folded_call(json const& call, json& result);
+		bool is_pure_call(json const& call);
+		bool is_pure_call(tagged_value const& call);
+		size_t fold_arguments(json& call);
+		size_t fold_arguments(tagged_value& call, std::pmr::memory_resource* arena, source_map* spans);
+		json safe_call(defined_function const* func, std::vector<json> arguments, call_stack_element frame);
+		json safe_call(defined_function const* func, json* arguments, size_t arg_count, call_stack_element frame);
 
 		tree_type m_prefix_function_tree;
 		tree_type m_infix_function_tree;
 
-		std::map<std::string, defined_function, std::less<>> m_functions_by_sig; 
-		/// TODO: or `std::map<std::string, std::pair<defined_function*, size_t>> for multiple signatures
+		/// Keyed by the symbol of the canonical signature
+		std::map<symbol, defined_function> m_functions_by_sig; 
+		/// TODO: or `std::map<symbol, std::pair<defined_function*, size_t>> for multiple signatures
 
 		void find_local_functions(
 			tree_type const& in_tree,
-			std::vector<json>::const_iterator name_it,
-			std::vector<json>::const_iterator names_end,
+			symbol const* name_it,
+			symbol const* names_end,
 			std::set<defined_function const*>& found
 		) const;
-		std::vector<defined_function const*> find_local_functions(std::vector<json> const& arguments) const;
+		void find_local_functions(std::vector<symbol> const& parameter_names, size_t elem_count, std::set<defined_function const*>& found) const;
+
+		defined_function* add_function(std::string_view signature, eval_func func, function_flags flags);
+
+		/// `parameter_names` are the symbols of the words at the even (prefix calls) or odd (infix calls) positions of a call with `elem_count` elements
+		std::vector<defined_function const*> find_functions(std::vector<symbol> const& parameter_names, size_t elem_count, bool only_in_local = false) const;
+		/// Fills `parameter_names` with the symbols of the parameter names of the call `arguments`; returns false
+		/// if one of them is not a string or was never interned (in which case no function can match the call)
+		bool parameter_symbols(std::vector<json> const& arguments, std::vector<symbol>& parameter_names) const;
+		bool parameter_symbols(tagged_value const& call, std::vector<symbol>& parameter_names) const;
+
+		/// Like `find_functions`, but returns the only function the call resolves to (or null if none or several do),
+		/// looked up in `m_dispatch_index`, which merges the function trees of this context and all its parents
+		defined_function const* dispatch(std::vector<symbol> const& parameter_names, size_t elem_count) const;
+
+		/// Call shape (the kind of call and the symbols of its parameter names) → the function it resolves to, or null;
+		/// filled lazily by `dispatch`, and cleared when a function is bound in this context or any of its parents
+		mutable std::unordered_map<std::u32string, defined_function const*> m_dispatch_index;
+		mutable uint64_t m_dispatch_generation = 0;
+		mutable std::u32string m_dispatch_key;
+		mutable function_cache_stats_t m_function_cache_stats;
+		std::vector<symbol> m_parameter_names;
+
+		/// Like the `consume_*` functions, but produce `tagged_value`s
+		tagged_value read_atom(std::string_view& sexp_str, std::pmr::memory_resource* arena, bool view_source) const;
+		tagged_value read_list(std::string_view& sexp_str, std::pmr::memory_resource* arena, bool view_source, bool require_closing_delim = true, detail::span_recorder* spans = nullptr) const;
+		tagged_value read_element(std::string_view& sexp_str, std::pmr::memory_resource* arena, bool view_source, detail::span_recorder* spans = nullptr) const;
+
+		uint64_t m_bind_generation = 0;
+		bool m_frozen = false;
+
+		/// Reports an error if this context is frozen; `what` describes the attempted operation
+		bool check_not_frozen(std::string_view what) const;
+
+		/// Profiles of the functions called in this context; the addresses of functions never change while their contexts exist
+		std::unordered_map<defined_function const*, function_profile> m_function_profiles;
+		struct profiled_call
+		{
+			function_profile* profile = nullptr;
+			std::chrono::steady_clock::time_point start;
+			/// Time spent in the profiled calls made by this one
+			std::chrono::nanoseconds callee_time{};
+		};
+		std::vector<profiled_call> m_profiled_calls;
+		/// Only used in root contexts: profiles flushed by child contexts, by signature (which points into the symbol table of the root)
+		mutable std::mutex m_flushed_profiles_mutex;
+		mutable std::unordered_map<std::string_view, function_profile> m_flushed_profiles;
+
+		void begin_profiled_call(defined_function const* func, size_t arg_count);
+		void end_profiled_call() noexcept;
+
+		/// Keeps the frame of a call in `context::call` on the call stack (if `options.maintain_call_stack` is set) while it runs,
+		/// and removes it (with the frames of any calls in it that did not return) however the call ends, as frames point into templates
+		/// that may not outlive it
+		struct call_frame_scope
+		{
+			call_frame_scope(context& ctx, defined_function const* func, call_stack_element& frame)
+				: m_context(ctx.options.maintain_call_stack ? &ctx : nullptr)
+				, m_size(ctx.m_call_stack.size())
+			{
+				if (!m_context)
+					return;
+				frame.actual_function = func;
+				m_context->m_call_stack.push_back(frame);
+			}
+			~call_frame_scope()
+			{
+				if (m_context && m_context->m_call_stack.size() > m_size)
+					m_context->m_call_stack.erase(m_context->m_call_stack.begin() + m_size, m_context->m_call_stack.end());
+			}
+			call_frame_scope(call_frame_scope const&) = delete;
+			call_frame_scope& operator=(call_frame_scope const&) = delete;
+		private:
+			context* m_context;
+			size_t m_size;
+		};
+
+		/// Profiles a call in `context::call` if `options.profile_functions` is set; costs a single branch otherwise
+		struct profile_scope
+		{
+			profile_scope(context& ctx, defined_function const* func, size_t arg_count)
+				: m_context(ctx.options.profile_functions ? &ctx : nullptr)
+			{
+				if (m_context)
+					m_context->begin_profiled_call(func, arg_count);
+			}
+			~profile_scope() { if (m_context) m_context->end_profiled_call(); }
+			profile_scope(profile_scope const&) = delete;
+			profile_scope& operator=(profile_scope const&) = delete;
+		private:
+			context* m_context;
+		};
 
-		defined_function* add_function(std::string signature, eval_func func);
 
 		defined_function const* get_unknown_func_handler() const noexcept;
 	};
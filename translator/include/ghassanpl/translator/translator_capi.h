@@ -30,14 +30,24 @@ struct translator_context
 		bool call_stack_store_call_string;
 		bool strict_syntax;
 		char hex_prefix; /// If != 0, atoms that start with this prefix will try to be parsed as hex numbers first
+		bool memoize_unknown_vars; /// If true, the unknown variable getter is called at most once per variable during each `interpolate*` call
+		bool errors_as_values; /// If true, errors are recorded (see `translator_error_count`) and evaluate to error values instead of being thrown or passed to the error handler
+		bool track_source_spans; /// If true, templates are parsed with the positions of their calls, which errors (and the call stack) refer to; requires `maintain_call_stack`
+		bool profile_functions; /// If true, calls to functions are counted and timed, see `translator_function_profiles`
 	} options;
 };
 typedef struct translator_context translator_context;
 
 translator_context* translator_new_context();
+/// Creates a context whose parent is `parent`, which has to outlive it
+translator_context* translator_new_child_context(translator_context* parent);
 void translator_init_context_options(translator_context* context);
 void translator_delete_context(translator_context* context);
 
+/// Makes `context` and its parents read-only, so that they can be used from many threads, each through its own child context
+void translator_freeze_context(translator_context* context);
+bool translator_is_context_frozen(translator_context const* context);
+
 typedef struct value_t* value;
 typedef struct value_ref_t* value_ref;
 
@@ -49,9 +59,47 @@ void translator_set_unknown_func_eval(translator_context* context, translator_ev
 typedef value(*var_value_getter_func)(translator_context* context, const char* var_name, void* user_data);
 void translator_set_unknown_var_value_getter(translator_context* context, var_value_getter_func func, void* user_data);
 
+/// Called once before a template is rendered with the `num_names` names of the variables it references that are not set;
+/// should store a new value for each `var_names[i]` in `values[i]` (which are null initially); null values are retrieved
+/// through the unknown variable getter instead. The names are valid until the context is destroyed.
+typedef void(*var_batch_getter_func)(translator_context* context, const char** var_names, int num_names, value* values, void* user_data);
+void translator_set_unknown_vars_batch_getter(translator_context* context, var_batch_getter_func func, void* user_data);
+
 typedef value(*error_handler_func)(translator_context const* context, const char* error_desc, void* user_data);
 void translator_set_error_handler(translator_context* context, error_handler_func func, void* user_data);
 
+/// The errors recorded during the last render (if `options.errors_as_values` is set); the strings are valid until the next render
+int translator_error_count(translator_context const* context);
+const char* translator_error_message(translator_context const* context, int index);
+/// The call that reported the error (if the call stack is maintained with call strings), or an empty string
+const char* translator_error_call(translator_context const* context, int index);
+/// Stores the 1-based line and column of the call that reported the error (if `options.track_source_spans` is set) in `line` and `column`;
+/// returns false (storing nothing) if its position is not known
+bool translator_error_position(translator_context const* context, int index, int* line, int* column);
+
+#define TRANSLATOR_PROFILE_ARG_COUNT_BUCKETS 9
+
+/// The calls to a function recorded with `options.profile_functions` set
+typedef struct translator_function_profile
+{
+	/// Not null-terminated; valid until the root context is destroyed
+	const char* signature;
+	int signature_length;
+	unsigned long long calls;
+	/// Time spent in the function, including and excluding the functions it called
+	unsigned long long inclusive_time_ns;
+	unsigned long long exclusive_time_ns;
+	/// Number of calls with each argument count; the last element counts calls with at least that many arguments
+	unsigned long long calls_by_arg_count[TRANSLATOR_PROFILE_ARG_COUNT_BUCKETS];
+} translator_function_profile;
+
+/// Stores the profiles of up to `max_profiles` functions called in `context` (and, for a root context, in its children that were
+/// destroyed or flushed their profiles), most expensive (by exclusive time) first, in `profiles`; returns the number of profiled functions
+int translator_function_profiles(translator_context const* context, translator_function_profile* profiles, int max_profiles);
+/// Adds the profiles of `context` to those of its root context
+void translator_flush_function_profiles(translator_context* context);
+void translator_reset_function_profiles(translator_context* context);
+
 /// TODO: Changing `json_value_to_str_func` from C api
 
 /// TODO: Enumerating and retrieving eval_funcs
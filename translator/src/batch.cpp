@@ -0,0 +1,226 @@
+#include "../include/ghassanpl/translator/batch.hpp"
+#include "format.h"
+#include <limits>
+
+namespace translator
+{
+	using clock = std::chrono::steady_clock;
+
+	/// The remaining jobs of a worker are the range [first, last), packed into one word so that the worker
+	/// and the workers stealing from it can both take jobs with a single compare-exchange
+	static constexpr uint64_t pack_range(uint32_t first, uint32_t last) noexcept { return (uint64_t(first) << 32) | last; }
+	static constexpr uint32_t range_first(uint64_t range) noexcept { return uint32_t(range >> 32); }
+	static constexpr uint32_t range_last(uint64_t range) noexcept { return uint32_t(range); }
+
+	struct batch_renderer::worker
+	{
+		size_t index = 0;
+		std::atomic<uint64_t> range{ 0 };
+		std::unique_ptr<context> ctx;
+		batch_stats::worker_stats stats;
+		std::thread thread;
+	};
+
+	batch_renderer::batch_renderer(context& root, size_t worker_count, worker_setup_func worker_setup)
+		: m_root(root)
+		, m_worker_setup(std::move(worker_setup))
+	{
+		m_root.freeze();
+
+		if (worker_count == 0)
+			worker_count = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+
+		m_workers.reserve(worker_count);
+		for (size_t i = 0; i < worker_count; ++i)
+		{
+			auto& new_worker = m_workers.emplace_back(std::make_unique<worker>());
+			new_worker->index = i;
+			new_worker->ctx = std::make_unique<context>(&m_root);
+			if (m_worker_setup)
+				m_worker_setup(*new_worker->ctx);
+		}
+
+		/// Workers steal from each other, so they are only started when all of them exist
+		for (auto& new_worker : m_workers)
+			new_worker->thread = std::thread([this, self = new_worker.get()] { run_worker(*self); });
+	}
+
+	batch_renderer::~batch_renderer()
+	{
+		{
+			std::lock_guard lock{ m_mutex };
+			m_stopping = true;
+		}
+		m_batch_started.notify_all();
+		for (auto& worker : m_workers)
+			worker->thread.join();
+	}
+
+	batch_stats batch_renderer::render(batch_job const* jobs, size_t count, std::string* results)
+	{
+		if (count > std::numeric_limits<uint32_t>::max())
+		{
+			m_root.report_error(format("too many jobs in batch ({})", count));
+			return {};
+		}
+
+		std::lock_guard render_lock{ m_render_mutex };
+
+		const auto start = clock::now();
+		{
+			std::lock_guard lock{ m_mutex };
+			m_jobs = jobs;
+			m_results = results;
+			m_failed_jobs = 0;
+
+			const auto worker_count = m_workers.size();
+			for (size_t i = 0; i < worker_count; ++i)
+			{
+				m_workers[i]->range.store(pack_range(uint32_t(count * i / worker_count), uint32_t(count * (i + 1) / worker_count)));
+				m_workers[i]->stats = {};
+			}
+
+			m_busy_workers = worker_count;
+			++m_batch_number;
+		}
+		m_batch_started.notify_all();
+
+		{
+			std::unique_lock lock{ m_mutex };
+			m_batch_finished.wait(lock, [this] { return m_busy_workers == 0; });
+		}
+
+		batch_stats result;
+		result.jobs = count;
+		result.failed_jobs = m_failed_jobs;
+		result.wall_time = clock::now() - start;
+		result.workers.reserve(m_workers.size());
+		for (auto& worker : m_workers)
+		{
+			auto& stats = result.workers.emplace_back(worker->stats);
+			if (result.wall_time.count() > 0)
+				stats.utilization = double(stats.busy_time.count()) / double(result.wall_time.count());
+		}
+		return result;
+	}
+
+	std::vector<std::string> batch_renderer::render(std::vector<batch_job> const& jobs)
+	{
+		std::vector<std::string> results(jobs.size());
+		render(jobs.data(), jobs.size(), results.data());
+		return results;
+	}
+
+	void batch_renderer::run_worker(worker& self)
+	{
+		uint64_t last_batch = 0;
+		while (true)
+		{
+			{
+				std::unique_lock lock{ m_mutex };
+				m_batch_started.wait(lock, [&] { return m_stopping || m_batch_number != last_batch; });
+				if (m_stopping)
+					return;
+				last_batch = m_batch_number;
+			}
+
+			render_jobs(self);
+			/// So that the root context has the profiles of the whole batch when `render` returns
+			self.ctx->flush_function_profiles();
+
+			std::lock_guard lock{ m_mutex };
+			if (--m_busy_workers == 0)
+				m_batch_finished.notify_all();
+		}
+	}
+
+	void batch_renderer::render_jobs(worker& self)
+	{
+		auto& ctx = *self.ctx;
+		while (true)
+		{
+			auto range = self.range.load(std::memory_order_acquire);
+			const auto first = range_first(range);
+			if (first >= range_last(range))
+			{
+				if (steal_jobs(self))
+					continue;
+				return;
+			}
+			if (!self.range.compare_exchange_weak(range, pack_range(first + 1, range_last(range)), std::memory_order_acq_rel))
+				continue;
+
+			const auto job_start = clock::now();
+			auto const& job = m_jobs[first];
+			auto& result = m_results[first];
+			result.clear();
+			try
+			{
+				if (job.variables && job.variables->is_object())
+				{
+					for (auto const& [name, value] : job.variables->items())
+						ctx.set_user_var(name, value, true);
+				}
+
+				output_sink sink{ result };
+				if (job.compiled)
+					ctx.interpolate_compiled_to(sink, *job.compiled);
+				else
+					ctx.interpolate_to(sink, job.source);
+
+				/// Errors recorded as values (see `options.errors_as_values`) do not throw, and are cleared by the next render
+				if (!ctx.errors().empty())
+				{
+					result.clear();
+					for (auto const& error : ctx.errors())
+					{
+						if (!result.empty())
+							result += '\n';
+						result += error.message;
+					}
+					++m_failed_jobs;
+				}
+			}
+			catch (std::exception const& e)
+			{
+				result = e.what();
+				++m_failed_jobs;
+				ctx.reset_evaluation_state();
+			}
+			catch (...)
+			{
+				result = "unknown error";
+				++m_failed_jobs;
+				ctx.reset_evaluation_state();
+			}
+			ctx.own_variables().clear();
+
+			++self.stats.jobs;
+			self.stats.busy_time += clock::now() - job_start;
+		}
+	}
+
+	bool batch_renderer::steal_jobs(worker& self)
+	{
+		/// Takes the back half of the remaining jobs of the first worker (after this one) that has any left
+		const auto worker_count = m_workers.size();
+		for (size_t i = 1; i < worker_count; ++i)
+		{
+			auto& victim = *m_workers[(self.index + i) % worker_count];
+			auto range = victim.range.load(std::memory_order_acquire);
+			while (range_first(range) < range_last(range))
+			{
+				const auto first = range_first(range), last = range_last(range);
+				const auto middle = last - (last - first + 1) / 2;
+				if (victim.range.compare_exchange_weak(range, pack_range(first, middle), std::memory_order_acq_rel))
+				{
+					/// Our range is empty, and nobody steals from empty ranges, so we are the only ones writing to it
+					self.range.store(pack_range(middle, last), std::memory_order_release);
+					++self.stats.steals;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+}
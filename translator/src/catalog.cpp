@@ -0,0 +1,540 @@
+#include "../include/ghassanpl/translator/catalog.hpp"
+#include "../include/ghassanpl/translator/render_profiler.hpp"
+#include "format.h"
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace translator
+{
+	/// ////////////////////////////////////////////////////////////////////////// ///
+	/// Binary catalog format
+	///
+	/// All integers are stored in the byte order of the machine that wrote the catalog (checked with `byte_order_mark`).
+	/// The header is followed by the message table, the node table and the string data, at the offsets given in the header.
+	/// Each node is a `tagged_value`; the elements of calls and arrays are stored in consecutive nodes, after their parent.
+	/// ////////////////////////////////////////////////////////////////////////// ///
+
+	namespace
+	{
+		constexpr char binary_magic[4] = { 'T', 'R', 'C', 'B' };
+		constexpr uint32_t binary_version = 1;
+		constexpr uint32_t byte_order_mark = 0x01020304;
+
+		struct binary_header
+		{
+			char magic[4];
+			uint32_t version;
+			uint32_t byte_order;
+			uint32_t message_count;
+			uint64_t node_count;
+			uint64_t messages_offset;
+			uint64_t nodes_offset;
+			uint64_t strings_offset;
+			uint64_t strings_size;
+		};
+
+		struct binary_message
+		{
+			uint64_t id_offset;
+			uint32_t id_length;
+			uint32_t root_node;
+		};
+
+		struct binary_node
+		{
+			tagged_value::kind type;
+			uint8_t reserved[3];
+			/// Length of strings, words and errors; number of elements of calls and arrays
+			uint32_t count;
+			/// Offset of the text of strings, words and errors; index of the first element of calls and arrays; value of everything else
+			uint64_t payload;
+		};
+
+		static_assert(sizeof(binary_header) % 8 == 0 && sizeof(binary_message) % 8 == 0 && sizeof(binary_node) % 8 == 0);
+	}
+
+	struct catalog::binary_image
+	{
+		char const* data = nullptr;
+		size_t size = 0;
+		/// Set if `data` was mapped by `map_binary_file`, and has to be unmapped
+		bool mapped = false;
+
+		binary_header const& header() const noexcept { return *reinterpret_cast<binary_header const*>(data); }
+		binary_message const* messages() const noexcept { return reinterpret_cast<binary_message const*>(data + header().messages_offset); }
+		binary_node const* nodes() const noexcept { return reinterpret_cast<binary_node const*>(data + header().nodes_offset); }
+
+		/// Returns nothing if the text is out of bounds
+		std::optional<std::string_view> text(uint64_t offset, uint64_t length) const noexcept
+		{
+			if (offset > header().strings_size || length > header().strings_size - offset)
+				return std::nullopt;
+			return std::string_view{ data + header().strings_offset + offset, size_t(length) };
+		}
+
+		~binary_image()
+		{
+			if (!mapped)
+				return;
+#ifdef _WIN32
+			::UnmapViewOfFile(data);
+#else
+			::munmap(const_cast<char*>(data), size);
+#endif
+		}
+	};
+
+	catalog::catalog(context& ctx, std::pmr::memory_resource* upstream)
+		: m_context(ctx)
+		, m_arena(std::make_unique<std::pmr::monotonic_buffer_resource>(upstream))
+	{
+	}
+
+	catalog::~catalog() = default;
+
+	std::string_view catalog::store(std::string_view str)
+	{
+		const auto result = static_cast<char*>(m_arena->allocate(str.size(), 1));
+		std::copy(str.begin(), str.end(), result);
+		return { result, str.size() };
+	}
+
+	message_id catalog::add(std::string_view id, std::string_view source)
+	{
+		entry new_entry;
+		new_entry.id = id;
+		new_entry.source = store(source);
+		new_entry.parsed = m_context.parse_value(new_entry.source, m_arena.get(), true, m_context.options.track_source_spans ? &m_spans : nullptr);
+		return add_entry(std::move(new_entry));
+	}
+
+	message_id catalog::add_entry(entry new_entry)
+	{
+		/// Replaced messages stay in the arena until the catalog is destroyed
+		if (const auto existing = find(new_entry.id))
+		{
+			new_entry.id = m_entries[existing.index].id;
+			m_entries[existing.index] = std::move(new_entry);
+			return existing;
+		}
+
+		/// Ids of messages from binary catalogs already point into the image
+		if (!new_entry.image)
+			new_entry.id = store(new_entry.id);
+
+		const auto index = uint32_t(m_entries.size());
+		m_ids.emplace(new_entry.id, index);
+		m_entries.push_back(std::move(new_entry));
+		return { index };
+	}
+
+	void catalog::load(json const& messages)
+	{
+		if (!messages.is_object())
+		{
+			m_context.report_error("catalog must be an object of message id -> template pairs");
+			return;
+		}
+
+		m_entries.reserve(m_entries.size() + messages.size());
+		for (auto const& [id, source] : messages.items())
+		{
+			if (source.is_string())
+				add(id, source.get_ref<json::string_t const&>());
+			else
+				m_context.report_error(format("template of message '{}' must be a string", id));
+		}
+	}
+
+	void catalog::load_file(std::filesystem::path const& path)
+	{
+		std::ifstream file{ path };
+		if (!file)
+		{
+			m_context.report_error(format("could not open catalog file '{}'", path.string()));
+			return;
+		}
+
+		const auto messages = json::parse(file, nullptr, false);
+		if (messages.is_discarded())
+		{
+			m_context.report_error(format("catalog file '{}' is not valid JSON", path.string()));
+			return;
+		}
+
+		load(messages);
+	}
+
+	void catalog::save_binary(std::ostream& out)
+	{
+		std::vector<binary_message> messages;
+		std::vector<binary_node> nodes;
+		std::string strings;
+		std::unordered_map<std::string_view, uint64_t> string_offsets;
+
+		/// Ids and words are stored once
+		const auto add_string = [&](std::string_view str) -> uint64_t {
+			if (auto it = string_offsets.find(str); it != string_offsets.end())
+				return it->second;
+			const auto offset = uint64_t(strings.size());
+			strings += str;
+			string_offsets.emplace(str, offset);
+			return offset;
+		};
+
+		/// Elements are stored after their parent, so nodes are reserved first and filled in later
+		auto const& symbols = m_context.symbols();
+		const auto fill_node = [&](auto& self, size_t node_index, tagged_value const& val) -> void {
+			binary_node node{};
+			node.type = val.type();
+			switch (val.type())
+			{
+			case tagged_value::kind::boolean: node.payload = val.as_boolean(); break;
+			case tagged_value::kind::integer: node.payload = uint64_t(val.as_integer()); break;
+			case tagged_value::kind::unsigned_integer: node.payload = val.as_unsigned(); break;
+			case tagged_value::kind::floating: { const auto num = val.as_double(); std::memcpy(&node.payload, &num, sizeof(num)); break; }
+			case tagged_value::kind::string:
+			case tagged_value::kind::error:
+				node.count = uint32_t(val.str().size());
+				node.payload = add_string(val.str());
+				break;
+			case tagged_value::kind::word:
+			{
+				const auto name = symbols.name(val.as_word());
+				node.count = uint32_t(name.size());
+				node.payload = add_string(name);
+				break;
+			}
+			case tagged_value::kind::call:
+			case tagged_value::kind::array:
+			{
+				auto const& elements = val.elements();
+				node.count = uint32_t(elements.size());
+				node.payload = nodes.size();
+				nodes.resize(nodes.size() + elements.size());
+				for (size_t i = 0; i < elements.size(); ++i)
+					self(self, size_t(node.payload + i), elements[i]);
+				break;
+			}
+			default:
+				/// Parsed templates cannot contain objects
+				node.type = tagged_value::kind::null;
+				break;
+			}
+			nodes[node_index] = node;
+		};
+
+		for (auto& message : m_entries)
+		{
+			const auto root_node = nodes.size();
+			nodes.emplace_back();
+			fill_node(fill_node, root_node, parsed(message));
+			messages.push_back({ add_string(message.id), uint32_t(message.id.size()), uint32_t(root_node) });
+		}
+
+		binary_header header{};
+		std::copy(std::begin(binary_magic), std::end(binary_magic), header.magic);
+		header.version = binary_version;
+		header.byte_order = byte_order_mark;
+		header.message_count = uint32_t(messages.size());
+		header.node_count = nodes.size();
+		header.messages_offset = sizeof(binary_header);
+		header.nodes_offset = header.messages_offset + messages.size() * sizeof(binary_message);
+		header.strings_offset = header.nodes_offset + nodes.size() * sizeof(binary_node);
+		header.strings_size = strings.size();
+
+		out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+		out.write(reinterpret_cast<char const*>(messages.data()), std::streamsize(messages.size() * sizeof(binary_message)));
+		out.write(reinterpret_cast<char const*>(nodes.data()), std::streamsize(nodes.size() * sizeof(binary_node)));
+		out.write(strings.data(), std::streamsize(strings.size()));
+		if (!out)
+			m_context.report_error("could not write binary catalog");
+	}
+
+	void catalog::save_binary_file(std::filesystem::path const& path)
+	{
+		std::ofstream file{ path, std::ios::binary };
+		if (!file)
+		{
+			m_context.report_error(format("could not open binary catalog file '{}' for writing", path.string()));
+			return;
+		}
+		save_binary(file);
+	}
+
+	void catalog::map_binary_file(std::filesystem::path const& path)
+	{
+		auto image = std::make_unique<binary_image>();
+
+#ifdef _WIN32
+		const auto file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER file_size{};
+		if (file != INVALID_HANDLE_VALUE && ::GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+		{
+			if (const auto mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr))
+			{
+				image->data = static_cast<char const*>(::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				image->size = size_t(file_size.QuadPart);
+				::CloseHandle(mapping);
+			}
+		}
+		if (file != INVALID_HANDLE_VALUE)
+			::CloseHandle(file);
+#else
+		const auto file = ::open(path.c_str(), O_RDONLY);
+		struct stat file_stat {};
+		if (file != -1 && ::fstat(file, &file_stat) == 0 && file_stat.st_size > 0)
+		{
+			if (const auto data = ::mmap(nullptr, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, file, 0); data != MAP_FAILED)
+			{
+				image->data = static_cast<char const*>(data);
+				image->size = size_t(file_stat.st_size);
+			}
+		}
+		if (file != -1)
+			::close(file);
+#endif
+
+		if (!image->data)
+		{
+			m_context.report_error(format("could not map binary catalog file '{}'", path.string()));
+			return;
+		}
+
+		image->mapped = true;
+		add_binary_image(std::move(image));
+	}
+
+	void catalog::load_binary(void const* data, size_t size)
+	{
+		auto image = std::make_unique<binary_image>();
+		image->data = static_cast<char const*>(data);
+		image->size = size;
+		add_binary_image(std::move(image));
+	}
+
+	void catalog::add_binary_image(std::unique_ptr<binary_image> image)
+	{
+		/// Only the header and the message table are read here; nodes are validated as they are decoded
+		const auto size = uint64_t(image->size);
+		const auto valid = [&] {
+			if (reinterpret_cast<uintptr_t>(image->data) % alignof(binary_header) != 0 || size < sizeof(binary_header))
+				return false;
+			auto const& header = image->header();
+			return std::equal(std::begin(binary_magic), std::end(binary_magic), header.magic)
+				&& header.version == binary_version
+				&& header.byte_order == byte_order_mark
+				&& header.messages_offset % 8 == 0 && header.nodes_offset % 8 == 0
+				&& header.messages_offset <= size && header.message_count <= (size - header.messages_offset) / sizeof(binary_message)
+				&& header.nodes_offset <= size && header.node_count <= (size - header.nodes_offset) / sizeof(binary_node)
+				&& header.strings_offset <= size && header.strings_size <= size - header.strings_offset;
+		}();
+		if (!valid)
+		{
+			m_context.report_error("invalid binary catalog");
+			return;
+		}
+
+		auto const& header = image->header();
+		m_entries.reserve(m_entries.size() + header.message_count);
+		for (uint32_t i = 0; i < header.message_count; ++i)
+		{
+			auto const& message = image->messages()[i];
+			if (message.root_node >= header.node_count)
+			{
+				m_context.report_error(format("invalid root node of message {} in binary catalog", i));
+				continue;
+			}
+
+			const auto id = image->text(message.id_offset, message.id_length);
+			if (!id)
+			{
+				m_context.report_error(format("invalid id of message {} in binary catalog", i));
+				continue;
+			}
+
+			entry new_entry;
+			new_entry.id = *id;
+			new_entry.image = image.get();
+			new_entry.root_node = message.root_node;
+			add_entry(std::move(new_entry));
+		}
+
+		m_images.push_back(std::move(image));
+	}
+
+	size_t catalog::fold_constants()
+	{
+		size_t folded = 0;
+		for (auto& message : m_entries)
+		{
+			parsed(message);
+			if (const auto message_folded = m_context.fold_constants(message.parsed, m_arena.get(), &m_spans))
+			{
+				folded += message_folded;
+				message.compiled = {};
+			}
+		}
+		return folded;
+	}
+
+	tagged_value const& catalog::parsed(entry& message)
+	{
+		if (message.image)
+		{
+			message.parsed = decode(*message.image, message.root_node);
+			message.image = nullptr;
+		}
+		return message.parsed;
+	}
+
+	tagged_value catalog::decode(binary_image const& image, uint32_t root_index)
+	{
+		/// Strings refer to the image; everything else that needs memory is allocated from the arena
+		const auto invalid_node = [&](uint32_t node_index) -> tagged_value {
+			return { m_context.report_error(format("invalid node {} in binary catalog", node_index)), m_arena.get() };
+		};
+		const auto decode_atom = [&](uint32_t node_index) -> tagged_value {
+			auto const& node = image.nodes()[node_index];
+			switch (node.type)
+			{
+			case tagged_value::kind::null: return nullptr;
+			case tagged_value::kind::boolean: return node.payload != 0;
+			case tagged_value::kind::integer: return int64_t(node.payload);
+			case tagged_value::kind::unsigned_integer: return node.payload;
+			case tagged_value::kind::floating: { double result{}; std::memcpy(&result, &node.payload, sizeof(result)); return result; }
+			case tagged_value::kind::string:
+			case tagged_value::kind::word:
+			case tagged_value::kind::error:
+				break;
+			default:
+				return invalid_node(node_index);
+			}
+
+			const auto text = image.text(node.payload, node.count);
+			if (!text)
+				return invalid_node(node_index);
+			if (node.type == tagged_value::kind::string)
+				return tagged_value::make_view(*text);
+			if (node.type == tagged_value::kind::word)
+				return tagged_value::make_word(m_context.symbols().intern(*text));
+			return tagged_value::make_error(*text, m_arena.get());
+		};
+
+		/// Decoded depth-first, with an explicit stack, so that deeply nested images cannot overflow the call stack.
+		/// `save_binary` gives each list its elements in the order the lists are visited here, so each range of elements has to start
+		/// at or after the end of the previous one; as ranges cannot overlap, no node is decoded twice (and there can be no cycles).
+		struct pending_list
+		{
+			uint32_t node_index;
+			tagged_value::array_t elements;
+		};
+		std::vector<pending_list> stack;
+		const auto node_count = image.header().node_count;
+		uint64_t elements_end = 0;
+		tagged_value result;
+
+		/// Decodes the node into `result`, or returns false if it is a list, whose elements are decoded next
+		const auto visit = [&](uint32_t node_index) -> bool {
+			auto const& node = image.nodes()[node_index];
+			if (node.type != tagged_value::kind::call && node.type != tagged_value::kind::array)
+			{
+				result = decode_atom(node_index);
+				return true;
+			}
+			if (node.payload <= node_index || node.payload < elements_end || node.payload > node_count || node.count > node_count - node.payload)
+			{
+				result = invalid_node(node_index);
+				return true;
+			}
+			elements_end = node.payload + node.count;
+			auto& list = stack.emplace_back(pending_list{ node_index, tagged_value::array_t(m_arena.get()) });
+			list.elements.reserve(node.count);
+			return false;
+		};
+
+		visit(root_index);
+		while (!stack.empty())
+		{
+			auto& list = stack.back();
+			auto const& node = image.nodes()[list.node_index];
+			if (list.elements.size() < node.count)
+			{
+				if (visit(uint32_t(node.payload + list.elements.size())))
+					stack.back().elements.push_back(std::move(result));
+				continue;
+			}
+
+			result = node.type == tagged_value::kind::call
+				? tagged_value::make_call(std::move(list.elements), m_arena.get())
+				: tagged_value::make_array(std::move(list.elements), m_arena.get());
+			stack.pop_back();
+			if (!stack.empty())
+				stack.back().elements.push_back(std::move(result));
+		}
+		return result;
+	}
+
+	message_id catalog::find(std::string_view id) const noexcept
+	{
+		if (auto it = m_ids.find(id); it != m_ids.end())
+			return { it->second };
+		return {};
+	}
+
+	std::string catalog::translate(std::string_view id)
+	{
+		std::string result;
+		output_sink sink{ result };
+		translate(id, sink);
+		return result;
+	}
+
+	std::string catalog::translate(message_id id)
+	{
+		std::string result;
+		output_sink sink{ result };
+		translate(id, sink);
+		return result;
+	}
+
+	void catalog::translate(std::string_view id, output_sink& sink)
+	{
+		if (const auto message = find(id))
+			translate(message, sink);
+		else
+			sink.append(m_context.report_error(format("unknown message id '{}'", id)));
+	}
+
+	void catalog::translate(message_id id, output_sink& sink)
+	{
+		if (id.index >= m_entries.size())
+		{
+			sink.append(m_context.report_error(format("invalid message id {}", id.index)));
+			return;
+		}
+
+		auto& message = m_entries[id.index];
+		if (const auto profiler = m_context.get_render_profiler())
+			return profiler->measure(message.id, sink, [&] { render(message, sink); });
+		render(message, sink);
+	}
+
+	void catalog::render(entry& message, output_sink& sink)
+	{
+		if (!m_context.is_current(message.compiled))
+			message.compiled = m_context.compile(parsed(message), &m_spans);
+
+		m_context.interpolate_compiled_to(sink, message.compiled);
+	}
+}
@@ -0,0 +1,40 @@
+#include "../include/ghassanpl/translator/translator.h"
+#include "format.h"
+
+#include <iostream>
+
+using namespace translator;
+
+/// Compiles JSON message catalogs (see `catalog::load_file`) into a single binary catalog (see `catalog::save_binary`)
+/// that can be loaded with `catalog::map_binary_file` without parsing.
+///
+/// Templates are parsed with the default context options, so the catalog should be loaded into contexts that use them as well.
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: " << argv[0] << " <catalog.json>... <output>\n";
+		return 1;
+	}
+
+	context ctx;
+	ctx.error_handler() = [](context const&, std::string_view err) -> std::string {
+		throw std::runtime_error(std::string{ err });
+	};
+
+	try
+	{
+		catalog messages{ ctx };
+		for (int i = 1; i < argc - 1; ++i)
+			messages.load_file(argv[i]);
+		messages.save_binary_file(argv[argc - 1]);
+		std::cout << format("{} messages written to '{}'\n", messages.size(), argv[argc - 1]);
+	}
+	catch (std::exception const& e)
+	{
+		std::cerr << format("error: {}\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
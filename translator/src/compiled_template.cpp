@@ -0,0 +1,791 @@
+#include "../include/ghassanpl/translator/translator.hpp"
+#include "../include/ghassanpl/translator/core_lib.hpp"
+#include "format.h"
+#include <array>
+
+namespace translator
+{
+	using opcode = compiled_template::opcode;
+
+	/// Native functions with at most this many arguments are called from compiled templates without allocating a vector
+	static constexpr uint32_t max_inline_native_args = 8;
+
+	static uint32_t add_constant(compiled_template& result, tagged_value val)
+	{
+		result.constants.push_back(std::move(val));
+		return uint32_t(result.constants.size() - 1);
+	}
+
+	static uint32_t add_literal(compiled_template& result, json val)
+	{
+		result.literals.push_back(std::move(val));
+		return uint32_t(result.literals.size() - 1);
+	}
+
+	/// Words and strings are indistinguishable once converted to `json`, so they are treated the same here
+	static std::string_view text_of(symbol_table const& symbols, tagged_value const& val)
+	{
+		if (val.is_word()) return symbols.name(val.as_word());
+		if (val.is_string()) return val.str();
+		return {};
+	}
+
+	static void collect_variables(context const& ctx, tagged_value const& call, std::vector<symbol>& result)
+	{
+		for (auto const& arg : call.elements())
+		{
+			if (arg.has_elements())
+				collect_variables(ctx, arg, result);
+			else if (const auto name = text_of(ctx.symbols(), arg); name.size() > 1 && name[0] == ctx.options.var_symbol)
+				result.push_back(ctx.symbols().intern(name.substr(1)));
+		}
+	}
+
+	std::vector<symbol> context::referenced_variables(tagged_value const& parsed) const
+	{
+		std::vector<symbol> result;
+		if (!parsed.has_elements())
+			return result;
+		/// Top-level strings are literal text
+		for (auto const& r : parsed.elements())
+		{
+			if (r.has_elements())
+				collect_variables(*this, r, result);
+		}
+		std::sort(result.begin(), result.end(), [](symbol a, symbol b) { return a.id < b.id; });
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+		return result;
+	}
+
+	/// Adds the spans `from` has for the nodes of `json_node` to `to`, for the corresponding nodes of `converted` (its conversion to `tagged_value`)
+	static void convert_spans(json const& json_node, tagged_value const& converted, source_map const& from, std::unordered_map<void const*, source_span>& to)
+	{
+		if (const auto span = from.find(json_node))
+			to[&converted] = *span;
+		if (json_node.is_array() && converted.has_elements())
+		{
+			auto const& elements = converted.elements();
+			for (size_t i = 0; i < elements.size() && i < json_node.size(); ++i)
+				convert_spans(json_node[i], elements[i], from, to);
+		}
+	}
+
+	compiled_template context::compile(json const& parsed, source_map const* spans) const
+	{
+		const auto converted = tagged_value::from_json(parsed);
+		if (!spans || spans->empty())
+			return compile(converted);
+
+		source_map converted_spans;
+		convert_spans(parsed, converted, *spans, converted_spans.m_spans);
+		return compile(converted, &converted_spans);
+	}
+
+	compiled_template context::compile(tagged_value const& parsed, source_map const* spans) const
+	{
+		compiled_template result;
+		result.linked_context = this;
+		result.bind_generation = bind_generation();
+		result.source = parsed;
+		result.relinked = std::make_shared<compiled_template::relinked_template>();
+
+		const auto invalid = [&] {
+			/// Mimic `interpolate_parsed`, which outputs whatever the error handler returns
+			auto error = report_error("Invalid parsed value: must be an array of strings or call arrays");
+			result.code.clear();
+			result.constants.clear();
+			result.literals.clear();
+			result.max_stack_size = 0;
+			result.spans.clear();
+			result.code.push_back({ opcode::append_text, add_constant(result, std::move(error)) });
+			return std::move(result);
+		};
+
+		if (!parsed.has_elements())
+			return invalid();
+
+		/// Templates converted from `json` have arrays instead of calls
+		for (auto const& r : parsed.elements())
+		{
+			if (r.has_elements())
+			{
+				/// Variables that are output directly are appended in place, without copying them onto the value stack
+				if (auto const& args = r.elements(); args.size() == 1)
+				{
+					if (const auto name = text_of(symbols(), args[0]); !name.empty() && name[0] == options.var_symbol)
+					{
+						result.code.push_back({ opcode::append_var, symbols().intern(name.substr(1)).id });
+						continue;
+					}
+				}
+
+				size_t stack_size = 0;
+				compile_call(result, r, stack_size, spans);
+				result.code.push_back({ opcode::append_value });
+			}
+			else if (r.is_string())
+				result.code.push_back({ opcode::append_text, add_constant(result, r) });
+			else
+				return invalid();
+		}
+
+		if (!result.spans.empty())
+			result.spans.resize(result.code.size());
+		result.variables = referenced_variables(parsed);
+		return result;
+	}
+
+	void context::compile_call(compiled_template& result, tagged_value const& call, size_t& stack_size, source_map const* spans) const
+	{
+		auto& symbols = this->symbols();
+		auto const& args = call.elements();
+
+		/// These mirror the special cases in `eval_list`
+		if (args.empty())
+		{
+			result.code.push_back({ opcode::push_literal, add_literal(result, nullptr) });
+			result.max_stack_size = std::max(result.max_stack_size, ++stack_size);
+			return;
+		}
+
+		if (const auto name = text_of(symbols, args[0]); args.size() == 1 && !name.empty() && name[0] == options.var_symbol)
+		{
+			result.code.push_back({ opcode::load_var, symbols.intern(name.substr(1)).id });
+			result.max_stack_size = std::max(result.max_stack_size, ++stack_size);
+			return;
+		}
+
+		const auto elem_count = args.size();
+		const bool infix = (elem_count % 2) == 1;
+
+		/// A name that was never interned cannot match any function
+		std::vector<symbol> parameter_names;
+		const auto function = parameter_symbols(call, parameter_names) ? dispatch(parameter_names, elem_count) : nullptr;
+		/// If the call does not resolve to exactly one function, leave it to `eval` to handle (or report) at run time
+		if (!function)
+		{
+			result.code.push_back({ opcode::eval, add_literal(result, call.to_json(symbols)) });
+			result.max_stack_size = std::max(result.max_stack_size, ++stack_size);
+			return;
+		}
+
+		/// Gather the arguments the same way `eval_list` does
+		std::vector<tagged_value const*> arguments;
+		if (elem_count > 1)
+		{
+			if (infix)
+				arguments.push_back(&args[0]);
+			for (size_t i = infix; i < elem_count; i += 2)
+				arguments.push_back(&args[i + 1]);
+		}
+
+		if (function->intrinsic != intrinsic_op::none && compile_intrinsic(result, function->intrinsic, arguments, stack_size, spans))
+			return;
+
+		/// Push the (unevaluated) arguments
+		const auto arg_count = uint32_t(arguments.size());
+		for (auto arg : arguments)
+			result.code.push_back({ opcode::push_literal, add_literal(result, arg->to_json(symbols)) });
+		result.max_stack_size = std::max(result.max_stack_size, stack_size + std::max(arg_count, 1u));
+
+		compiled_template::instruction call_instruction{ opcode::call, arg_count, function };
+		if (options.maintain_call_stack && options.call_stack_store_call_string)
+			call_instruction.call_desc = add_constant(result, call);
+		if (const auto span = spans && options.maintain_call_stack ? spans->find(call) : std::nullopt)
+		{
+			result.spans.resize(result.code.size());
+			result.spans.push_back(*span);
+		}
+		result.code.push_back(call_instruction);
+		++stack_size;
+	}
+
+	/// Compiles the evaluation of `arg` (as by `eval`), leaving its value on the value stack
+	void context::compile_argument(compiled_template& result, tagged_value const& arg, size_t& stack_size, source_map const* spans) const
+	{
+		if (arg.has_elements())
+			return compile_call(result, arg, stack_size, spans);
+
+		if (const auto name = text_of(symbols(), arg); !name.empty() && name[0] == options.var_symbol)
+		{
+			if (name.size() > 1)
+				result.code.push_back({ opcode::load_var, symbols().intern(name.substr(1)).id });
+			else
+				result.code.push_back({ opcode::eval, add_literal(result, arg.to_json(symbols())) });
+		}
+		else
+			result.code.push_back({ opcode::push_literal, add_literal(result, arg.to_json(symbols())) });
+		result.max_stack_size = std::max(result.max_stack_size, ++stack_size);
+	}
+
+	/// Returns false (having compiled nothing) if the call cannot be compiled as the intrinsic, in which case the function is called normally
+	bool context::compile_intrinsic(compiled_template& result, intrinsic_op op, std::vector<tagged_value const*> const& args, size_t& stack_size, source_map const* spans) const
+	{
+		auto& code = result.code;
+		const auto here = [&] { return uint32_t(code.size()); };
+		const auto emit_jump = [&](opcode jump_op) { code.push_back({ jump_op }); return code.size() - 1; };
+		const auto push = [&] { result.max_stack_size = std::max(result.max_stack_size, ++stack_size); };
+
+		switch (op)
+		{
+		case intrinsic_op::conditional:
+		{
+			if (args.size() != 3)
+				return false;
+			compile_argument(result, *args[0], stack_size, spans);
+			const auto to_else = emit_jump(opcode::jump_if_false);
+			--stack_size;
+			compile_argument(result, *args[1], stack_size, spans);
+			const auto to_end = emit_jump(opcode::jump);
+			--stack_size;
+			code[to_else].operand = here();
+			compile_argument(result, *args[2], stack_size, spans);
+			code[to_end].operand = here();
+			return true;
+		}
+		case intrinsic_op::equal:
+		case intrinsic_op::not_equal:
+		case intrinsic_op::greater:
+		case intrinsic_op::greater_equal:
+		case intrinsic_op::less:
+		case intrinsic_op::less_equal:
+		case intrinsic_op::add:
+		case intrinsic_op::subtract:
+		case intrinsic_op::multiply:
+		case intrinsic_op::divide:
+		case intrinsic_op::modulo:
+			if (args.size() != 2)
+				return false;
+			compile_argument(result, *args[0], stack_size, spans);
+			compile_argument(result, *args[1], stack_size, spans);
+			code.push_back({ opcode::binary_op, uint32_t(op) });
+			--stack_size;
+			return true;
+		case intrinsic_op::logical_not:
+			if (args.size() != 1)
+				return false;
+			compile_argument(result, *args[0], stack_size, spans);
+			code.push_back({ opcode::logical_not });
+			return true;
+		case intrinsic_op::logical_and:
+		case intrinsic_op::logical_or:
+		{
+			if (args.empty())
+				return false;
+			/// Short-circuits, leaving the value that decided the result on the stack
+			std::vector<size_t> to_end;
+			for (size_t i = 0; i < args.size(); ++i)
+			{
+				compile_argument(result, *args[i], stack_size, spans);
+				if (i + 1 == args.size())
+					break;
+				to_end.push_back(emit_jump(op == intrinsic_op::logical_and ? opcode::jump_if_false_or_pop : opcode::jump_if_true_or_pop));
+				--stack_size;
+			}
+			for (auto jump : to_end)
+				code[jump].operand = here();
+			return true;
+		}
+		case intrinsic_op::concatenate:
+		{
+			if (args.empty())
+				return false;
+			/// Stops at the first error, which becomes the result, like the function does
+			code.push_back({ opcode::push_literal, add_literal(result, "") });
+			push();
+			std::vector<size_t> to_end;
+			for (auto arg : args)
+			{
+				compile_argument(result, *arg, stack_size, spans);
+				to_end.push_back(emit_jump(opcode::concatenate_or_jump));
+				--stack_size;
+			}
+			for (auto jump : to_end)
+				code[jump].operand = here();
+			return true;
+		}
+		case intrinsic_op::match:
+		{
+			/// Malformed cases are left to the function to report
+			if (args.size() < 2 || !std::all_of(args.begin() + 1, args.end() - 1, [](auto arg) { return arg->has_elements() && arg->elements().size() >= 2; }))
+				return false;
+
+			compile_argument(result, *args[0], stack_size, spans);
+			std::vector<size_t> to_end;
+			for (size_t i = 1; i + 1 < args.size(); ++i)
+			{
+				auto const& match_case = args[i]->elements();
+				code.push_back({ opcode::dup });
+				push();
+				compile_argument(result, match_case[0], stack_size, spans);
+				code.push_back({ opcode::binary_op, uint32_t(intrinsic_op::equal) });
+				--stack_size;
+				const auto to_next_case = emit_jump(opcode::jump_if_false);
+				--stack_size;
+				code.push_back({ opcode::pop });
+				--stack_size;
+				compile_argument(result, match_case[1], stack_size, spans);
+				to_end.push_back(emit_jump(opcode::jump));
+				--stack_size;
+				code[to_next_case].operand = here();
+				++stack_size;
+			}
+			code.push_back({ opcode::pop });
+			--stack_size;
+			compile_argument(result, *args.back(), stack_size, spans);
+			for (auto jump : to_end)
+				code[jump].operand = here();
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	/// Whether `val` evaluates to itself, so that it can stand in for the call it is the result of
+	static bool is_literal(context const& ctx, json const& val)
+	{
+		if (val.is_array() || val.is_discarded())
+			return false;
+		if (val.is_string())
+		{
+			const auto str = std::string_view{ val };
+			return str.empty() || str[0] != ctx.options.var_symbol;
+		}
+		return true;
+	}
+
+	static bool is_literal(context const& ctx, tagged_value const& val)
+	{
+		if (val.has_elements())
+			return false;
+		if (val.is_string() || val.is_word())
+		{
+			const auto str = text_of(ctx.symbols(), val);
+			return str.empty() || str[0] != ctx.options.var_symbol;
+		}
+		return true;
+	}
+
+	/// Removes the spans of `node` and everything in it, which was folded away
+	static void forget_spans(tagged_value const& node, std::unordered_map<void const*, source_span>& spans)
+	{
+		spans.erase(&node);
+		if (node.has_elements())
+		{
+			for (auto const& element : node.elements())
+				forget_spans(element, spans);
+		}
+	}
+
+	/// Only scalars and strings can be allocated from an arena
+	static std::optional<tagged_value> to_arena_value(context const& ctx, json const& val, std::pmr::memory_resource* arena)
+	{
+		switch (val.type())
+		{
+		case json::value_t::null: return tagged_value{ nullptr };
+		case json::value_t::boolean: return tagged_value{ bool(val) };
+		case json::value_t::number_integer: return tagged_value{ val.get<int64_t>() };
+		case json::value_t::number_unsigned: return tagged_value{ val.get<uint64_t>() };
+		case json::value_t::number_float: return tagged_value{ val.get<double>() };
+		case json::value_t::string:
+			if (!is_literal(ctx, val))
+				return std::nullopt;
+			return tagged_value{ std::string_view{ val }, arena };
+		default: return std::nullopt;
+		}
+	}
+
+	bool context::try_fold_call(json const& call, json& result)
+	{
+		if (!call.is_array() || call.empty())
+			return false;
+		if (!std::all_of(call.begin(), call.end(), [this](json const& arg) { return is_literal(*this, arg); }))
+			return false;
+		if (!is_pure_call(call))
+			return false;
+		return eval_folded_call(call, result);
+	}
+
+	bool context::try_fold_call(tagged_value const& call, json& result)
+	{
+		if (!call.has_elements() || call.elements().empty())
+			return false;
+		auto const& args = call.elements();
+		if (!std::all_of(args.begin(), args.end(), [this](tagged_value const& arg) { return is_literal(*this, arg); }))
+			return false;
+		if (!is_pure_call(call))
+			return false;
+		return eval_folded_call(call.to_json(symbols()), result);
+	}
+
+	bool context::eval_folded_call(json const& call, json& result)
+	{
+		const auto call_stack_size = m_call_stack.size();
+		try
+		{
+			result = eval_list(call.get_ref<json::array_t const&>());
+			return true;
+		}
+		catch (...)
+		{
+			m_call_stack.resize(call_stack_size);
+			return false;
+		}
+	}
+
+	bool context::is_pure_call(json const& call)
+	{
+		if (!call.is_array() || call.empty() || !parameter_symbols(call.get_ref<json::array_t const&>(), m_parameter_names))
+			return false;
+		const auto function = dispatch(m_parameter_names, call.size());
+		return function && function->pure();
+	}
+
+	bool context::is_pure_call(tagged_value const& call)
+	{
+		if (!call.has_elements() || call.elements().empty() || !parameter_symbols(call, m_parameter_names))
+			return false;
+		const auto function = dispatch(m_parameter_names, call.elements().size());
+		return function && function->pure();
+	}
+
+	/// Functions that are not pure may not evaluate their arguments (or evaluate them differently), so those are left alone
+	size_t context::fold_arguments(json& call)
+	{
+		if (!is_pure_call(call))
+			return 0;
+
+		size_t folded = 0;
+		for (auto& arg : call)
+		{
+			if (!arg.is_array())
+				continue;
+			folded += fold_arguments(arg);
+			if (json result; try_fold_call(arg, result) && is_literal(*this, result))
+			{
+				arg = std::move(result);
+				++folded;
+			}
+		}
+		return folded;
+	}
+
+	size_t context::fold_arguments(tagged_value& call, std::pmr::memory_resource* arena, source_map* spans)
+	{
+		if (!is_pure_call(call))
+			return 0;
+
+		/// Arguments are folded before the calls they are in, so each call is converted to `json` (by `try_fold_call`) only once,
+		/// when all its arguments are literals
+		size_t folded = 0;
+		for (auto& arg : call.elements())
+		{
+			if (!arg.has_elements())
+				continue;
+			folded += fold_arguments(arg, arena, spans);
+			if (json result; try_fold_call(arg, result))
+			{
+				if (auto value = to_arena_value(*this, result, arena))
+				{
+					/// The value stands where the call was, so it keeps its span
+					std::optional<source_span> span;
+					if (spans)
+					{
+						span = spans->find(arg);
+						forget_spans(arg, spans->m_spans);
+					}
+					arg = std::move(*value);
+					if (span)
+						spans->m_spans[&arg] = *span;
+					++folded;
+				}
+			}
+		}
+		return folded;
+	}
+
+	size_t context::fold_constants(json& parsed)
+	{
+		if (!parsed.is_array() || !check_not_frozen("fold constants"))
+			return 0;
+
+		size_t folded = 0;
+		auto& elements = parsed.get_ref<json::array_t&>();
+		size_t kept = 0;
+		for (auto& r : elements)
+		{
+			if (r.is_array())
+			{
+				folded += fold_arguments(r);
+				if (json result; try_fold_call(r, result))
+				{
+					std::string text;
+					output_sink sink{ text };
+					append_value(sink, result);
+					r = std::move(text);
+					++folded;
+				}
+			}
+
+			/// Merge adjacent text
+			if (r.is_string() && r.get_ref<json::string_t const&>().empty())
+				continue;
+			if (r.is_string() && kept > 0 && elements[kept - 1].is_string())
+				elements[kept - 1].get_ref<json::string_t&>() += r.get_ref<json::string_t const&>();
+			else if (&elements[kept++] != &r)
+				elements[kept - 1] = std::move(r);
+		}
+		elements.erase(elements.begin() + kept, elements.end());
+		return folded;
+	}
+
+	size_t context::fold_constants(tagged_value& parsed, std::pmr::memory_resource* arena, source_map* spans)
+	{
+		if (!parsed.has_elements() || !check_not_frozen("fold constants"))
+			return 0;
+
+		size_t folded = 0;
+		auto& elements = parsed.elements();
+		size_t kept = 0;
+		for (auto& r : elements)
+		{
+			if (r.has_elements())
+			{
+				folded += fold_arguments(r, arena, spans);
+				if (json result; try_fold_call(r, result))
+				{
+					std::string text;
+					output_sink sink{ text };
+					append_value(sink, result);
+					/// Top-level text has no spans
+					if (spans)
+						forget_spans(r, spans->m_spans);
+					r = tagged_value{ text, arena };
+					++folded;
+				}
+			}
+
+			/// Merge adjacent text
+			if (r.is_string() && r.str().empty())
+				continue;
+			if (r.is_string() && kept > 0 && elements[kept - 1].is_string())
+			{
+				auto text = std::string{ elements[kept - 1].str() };
+				text += r.str();
+				elements[kept - 1] = tagged_value{ text, arena };
+			}
+			else if (&elements[kept++] != &r)
+			{
+				/// Only the call itself moves; its elements stay where they are. Earlier slots were already emptied (or hold text), so
+				/// their spans were already moved away or removed.
+				if (spans)
+				{
+					if (auto it = spans->m_spans.find(&r); it != spans->m_spans.end())
+					{
+						const auto span = it->second;
+						spans->m_spans.erase(it);
+						spans->m_spans[&elements[kept - 1]] = span;
+					}
+				}
+				elements[kept - 1] = std::move(r);
+			}
+		}
+		elements.erase(elements.begin() + kept, elements.end());
+		return folded;
+	}
+
+	size_t context::fold_constants(parsed_template& parsed)
+	{
+		return fold_constants(parsed.m_root, parsed.arena(), &parsed.m_spans);
+	}
+
+	std::string context::interpolate_compiled(compiled_template const& compiled)
+	{
+		std::string result;
+		output_sink sink{ result };
+		interpolate_compiled_to(sink, compiled);
+		return result;
+	}
+
+	std::shared_ptr<compiled_template const> context::relink(compiled_template const& compiled) const
+	{
+		/// Stale templates compiled in a frozen context can be rendered by many threads at once
+		std::lock_guard lock{ compiled.relinked->mutex };
+		auto& relinked = compiled.relinked->compiled;
+		if (!relinked || !is_current(*relinked))
+			relinked = std::make_shared<compiled_template const>(compile(compiled.source));
+		return relinked;
+	}
+
+	void context::interpolate_compiled_to(output_sink& sink, compiled_template const& compiled)
+	{
+		if (!check_not_frozen("evaluate templates"))
+			return;
+		if (compiled.empty())
+			return;
+
+		auto linked = static_cast<context const*>(this);
+		while (linked && linked != compiled.linked_context)
+			linked = linked->parent();
+		if (!linked)
+			return sink.append(report_error("compiled template was not compiled in this context or its parents"));
+		/// Its calls may resolve to different functions now
+		if (!linked->is_current(compiled))
+			return interpolate_compiled_to(sink, *linked->relink(compiled));
+
+		render_scope scope{ *this };
+		prefetch_unknown_vars(compiled.variables);
+		const auto stack_base = m_value_stack.size();
+		m_value_stack.reserve(stack_base + compiled.max_stack_size);
+
+		try
+		{
+			for (size_t pc = 0; pc < compiled.code.size();)
+			{
+				auto const& instruction = compiled.code[pc++];
+				switch (instruction.op)
+				{
+				case opcode::append_text:
+					sink.append(compiled.constants[instruction.operand].str());
+					break;
+				case opcode::push_literal:
+					m_value_stack.push_back(compiled.literals[instruction.operand]);
+					break;
+				case opcode::load_var:
+					m_value_stack.push_back(user_var(symbol{ instruction.operand }));
+					break;
+				case opcode::call:
+				{
+					call_stack_element frame;
+					if (instruction.call_desc != compiled_template::no_constant)
+						frame.compiled_call = &compiled.constants[instruction.call_desc];
+					if (!compiled.spans.empty() && compiled.spans[pc - 1].line)
+						frame.span = &compiled.spans[pc - 1];
+
+					const auto first_arg = m_value_stack.end() - instruction.operand;
+					json call_result;
+					if (instruction.function->native_func && instruction.operand <= max_inline_native_args)
+					{
+						/// The arguments cannot stay on the value stack, as the function can run other templates, which may grow it
+						std::array<json, max_inline_native_args> arguments;
+						std::move(first_arg, m_value_stack.end(), arguments.begin());
+						m_value_stack.erase(first_arg, m_value_stack.end());
+						call_result = safe_call(instruction.function, arguments.data(), instruction.operand, frame);
+					}
+					else
+					{
+						std::vector<json> arguments{ std::make_move_iterator(first_arg), std::make_move_iterator(m_value_stack.end()) };
+						m_value_stack.erase(first_arg, m_value_stack.end());
+						call_result = safe_call(instruction.function, std::move(arguments), frame);
+					}
+					m_value_stack.push_back(std::move(call_result));
+					break;
+				}
+				case opcode::eval:
+					m_value_stack.push_back(safe_eval(compiled.literals[instruction.operand]));
+					break;
+				case opcode::append_value:
+					append_value(sink, m_value_stack.back());
+					m_value_stack.pop_back();
+					break;
+				case opcode::append_var:
+				{
+					const auto name = symbol{ instruction.operand };
+					if (auto [owning_context, it] = find_variable(name); owning_context)
+						append_value(sink, it->second);
+					else
+						append_value(sink, user_var(name));
+					break;
+				}
+				case opcode::jump:
+					pc = instruction.operand;
+					break;
+				case opcode::jump_if_false:
+				{
+					const bool condition = is_true(m_value_stack.back());
+					m_value_stack.pop_back();
+					if (!condition)
+						pc = instruction.operand;
+					break;
+				}
+				case opcode::jump_if_false_or_pop:
+				case opcode::jump_if_true_or_pop:
+					if (is_true(m_value_stack.back()) == (instruction.op == opcode::jump_if_true_or_pop))
+						pc = instruction.operand;
+					else
+						m_value_stack.pop_back();
+					break;
+				case opcode::pop:
+					m_value_stack.pop_back();
+					break;
+				case opcode::dup:
+					m_value_stack.push_back(m_value_stack.back());
+					break;
+				case opcode::logical_not:
+					if (!is_error_value(m_value_stack.back()))
+						m_value_stack.back() = !is_true(m_value_stack.back());
+					break;
+				case opcode::binary_op:
+				{
+					auto rhs = std::move(m_value_stack.back());
+					m_value_stack.pop_back();
+					auto& lhs = m_value_stack.back();
+					lhs = detail::apply_binary_intrinsic(intrinsic_op(instruction.operand), lhs, rhs);
+					break;
+				}
+				case opcode::concatenate_or_jump:
+				{
+					auto value = std::move(m_value_stack.back());
+					m_value_stack.pop_back();
+					if (is_error_value(value))
+					{
+						m_value_stack.back() = std::move(value);
+						pc = instruction.operand;
+					}
+					else
+						m_value_stack.back().get_ref<std::string&>() += value_to_string(value);
+					break;
+				}
+				}
+			}
+		}
+		catch (...)
+		{
+			m_value_stack.resize(stack_base);
+			throw;
+		}
+
+		assert(m_value_stack.size() == stack_base);
+	}
+
+	json context::safe_call(defined_function const* func, std::vector<json> arguments, call_stack_element frame)
+	{
+		try
+		{
+			auto result = call(func, std::move(arguments), frame);
+			if (m_pending_terminator != scope_terminator::none)
+				return report_unhandled_terminator();
+			return result;
+		}
+		catch (e_scope_terminator const& e)
+		{
+			return report_error(format("'{}' not in loop", e.type()));
+		}
+	}
+
+	json context::safe_call(defined_function const* func, json* arguments, size_t arg_count, call_stack_element frame)
+	{
+		try
+		{
+			auto result = call(func, arguments, arg_count, frame);
+			if (m_pending_terminator != scope_terminator::none)
+				return report_unhandled_terminator();
+			return result;
+		}
+		catch (e_scope_terminator const& e)
+		{
+			return report_error(format("'{}' not in loop", e.type()));
+		}
+	}
+}
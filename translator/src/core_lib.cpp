@@ -0,0 +1,248 @@
+#include "../include/ghassanpl/translator/core_lib.hpp"
+#include "format.h"
+
+namespace translator
+{
+	namespace detail
+	{
+#define IMPL_OPF(lhs, op, rhs) \
+	const auto lhs_type = lhs.type();                                                                    \
+	const auto rhs_type = rhs.type();                                                                    \
+	if (lhs_type == json::value_t::number_integer && rhs_type == json::value_t::number_float) \
+		return static_cast<json::number_float_t>(lhs) op (json::number_float_t)rhs;      \
+	else if (lhs_type == json::value_t::number_float && rhs_type == json::value_t::number_integer)                   \
+		return (json::number_float_t)lhs op static_cast<json::number_float_t>(rhs);          \
+	else if (lhs_type == json::value_t::number_unsigned && rhs_type == json::value_t::number_float)                  \
+		return static_cast<json::number_float_t>(lhs) op (json::number_float_t)rhs;         \
+	else if (lhs_type == json::value_t::number_float && rhs_type == json::value_t::number_unsigned)                  \
+		return (json::number_float_t)lhs op static_cast<json::number_float_t>(rhs);         \
+	else if (lhs_type == json::value_t::number_unsigned && rhs_type == json::value_t::number_integer)                \
+		return static_cast<json::number_integer_t>(lhs) op (json::number_integer_t)rhs;     \
+	else if (lhs_type == json::value_t::number_integer && rhs_type == json::value_t::number_unsigned)                \
+		return (json::number_integer_t)lhs op static_cast<json::number_integer_t>(rhs);     \
+	else return 0;
+
+#define IMPL_OPI(lhs, op, rhs) \
+	const auto lhs_type = lhs.type();                                                                    \
+	const auto rhs_type = rhs.type();                                                                    \
+	if (lhs_type == json::value_t::number_unsigned && rhs_type == json::value_t::number_integer)                \
+		return static_cast<json::number_integer_t>(lhs) op (json::number_integer_t)rhs;     \
+	else if (lhs_type == json::value_t::number_integer && rhs_type == json::value_t::number_unsigned)                \
+		return (json::number_integer_t)lhs op static_cast<json::number_integer_t>(rhs);     \
+	else return 0;
+
+		json apply_binary_intrinsic(intrinsic_op op, json const& lhs, json const& rhs)
+		{
+			if (is_error_value(lhs)) return lhs;
+			if (is_error_value(rhs)) return rhs;
+
+			switch (op)
+			{
+			case intrinsic_op::equal: return lhs == rhs;
+			case intrinsic_op::not_equal: return lhs != rhs;
+			case intrinsic_op::greater: return lhs > rhs;
+			case intrinsic_op::greater_equal: return lhs >= rhs;
+			case intrinsic_op::less: return lhs < rhs;
+			case intrinsic_op::less_equal: return lhs <= rhs;
+			case intrinsic_op::add: { IMPL_OPF(lhs, +, rhs); }
+			case intrinsic_op::subtract: { IMPL_OPF(lhs, -, rhs); }
+			case intrinsic_op::multiply: { IMPL_OPF(lhs, *, rhs); }
+			case intrinsic_op::divide: { IMPL_OPF(lhs, /, rhs); }
+			case intrinsic_op::modulo: { IMPL_OPI(lhs, %, rhs); }
+			default:
+				assert(false);
+				return nullptr;
+			}
+		}
+
+#undef IMPL_OPF
+#undef IMPL_OPI
+	}
+
+	/// Evaluates the condition and only one of the branches
+	static json if_then_else(context& e, argument_span args)
+	{
+		e.assert_args(args, 3);
+		if (is_true(e.eval(std::move(args[0]))))
+			return e.eval(std::move(args[1]));
+		return e.eval(std::move(args[2]));
+	}
+
+	static json op_is(context& e, std::vector<json> args)
+	{
+		e.eval_args(args, 2);
+		e.assert_arg(args, 1, json::value_t::string);
+		return args[0].type_name() == args[1];
+	}
+
+	template <intrinsic_op OP>
+	static json binary_op(context& e, argument_span args)
+	{
+		e.assert_args(args, 2);
+		auto lhs = e.eval(std::move(args[0]));
+		auto rhs = e.eval(std::move(args[1]));
+		return detail::apply_binary_intrinsic(OP, lhs, rhs);
+	}
+
+	static json op_not(context& e, argument_span args)
+	{
+		e.assert_args(args, 1);
+		auto val = e.eval(std::move(args[0]));
+		if (is_error_value(val))
+			return val;
+		return !is_true(val);
+	}
+
+	/// Returns the first argument that is false, or the last one
+	static json op_and(context& e, argument_span args)
+	{
+		json left;
+		for (auto& arg : args)
+		{
+			left = e.eval(std::move(arg));
+			if (!is_true(left))
+				return left;
+		}
+		return left;
+	}
+
+	/// Returns the first argument that is true, or the last one
+	static json op_or(context& e, argument_span args)
+	{
+		json left;
+		for (auto& arg : args)
+		{
+			left = e.eval(std::move(arg));
+			if (is_true(left))
+				return left;
+		}
+		return left;
+	}
+
+	static json type_of(context& e, std::vector<json> args) {
+		const auto val = e.eval_arg_steal(args, 0);
+		return val.type_name();
+	}
+
+	static json size_of(context& e, std::vector<json> args) {
+		const auto val = e.eval_arg_steal(args, 0);
+		const json& j = val;
+		return j.is_string() ? j.get_ref<json::string_t const&>().size() : j.size();
+	}
+
+	static json str(context& e, std::vector<json> args)
+	{
+		auto arg = e.eval_arg_steal(args, 0);
+		return e.value_to_string(arg);
+	}
+
+	/// Will evaluate each argument and return the last one
+	[[maybe_unused]] static json eval(context& e, std::vector<json> args)
+	{
+		json last = nullptr;
+		for (size_t i = 0; i < args.size(); ++i)
+			last = e.eval(std::move(args[i]));
+		return last;
+	}
+
+	/// Will evaluate each argument and return a list of the results
+	static json list(context& e, std::vector<json> args)
+	{
+		e.eval_args(args);
+		std::vector<json> result;
+		for (size_t i = 0; i < args.size(); ++i)
+			result.push_back(std::move(args[i]));
+		return result;
+	}
+
+	/// Will evaluate each argument and concatenate them in a string
+	static json op_cat(context& e, argument_span args)
+	{
+		std::string result;
+		for (auto& arg : args)
+		{
+			auto val = e.eval(std::move(arg));
+			if (is_error_value(val))
+				return val;
+			result += e.value_to_string(val);
+		}
+		return result;
+	}
+
+	static json match(context& e, std::vector<json> args)
+	{
+		e.assert_min_args(args, 2);
+		auto val = e.eval_arg_steal(args, 0);
+		for (size_t i = 1; i < args.size() - 1; i++)
+		{
+			e.assert_arg(args, i, json::value_t::array);
+			auto& match_case = args[i];
+			if (match_case.size() < 2)
+				return e.report_error(format("case #{} in match must have at least 2 arguments", i));
+			auto case_val = e.eval(move(match_case[0]));
+			if (val == case_val)
+				return e.eval(move(match_case[1]));
+		}
+		return e.eval_arg_steal(args, args.size() - 1);
+	}
+
+	void open_core_lib(context& e)
+	{
+		/// TODO: [pred .kills with [one? 'bla'], [zero? 'bleh'], [many? 'bluh']]
+	
+		e.set_intrinsic(e.bind_function("if arg then arg else arg", if_then_else, function_flag::pure), intrinsic_op::conditional);
+		e.set_intrinsic(e.bind_function("arg ? arg : arg", if_then_else, function_flag::pure), intrinsic_op::conditional);
+
+		e.set_intrinsic(e.bind_function("arg == arg", binary_op<intrinsic_op::equal>, function_flag::pure), intrinsic_op::equal);
+		e.set_intrinsic(e.bind_function("arg eq arg", binary_op<intrinsic_op::equal>, function_flag::pure), intrinsic_op::equal);
+		e.set_intrinsic(e.bind_function("arg != arg", binary_op<intrinsic_op::not_equal>, function_flag::pure), intrinsic_op::not_equal);
+		e.set_intrinsic(e.bind_function("arg neq arg", binary_op<intrinsic_op::not_equal>, function_flag::pure), intrinsic_op::not_equal);
+		e.set_intrinsic(e.bind_function("arg > arg", binary_op<intrinsic_op::greater>, function_flag::pure), intrinsic_op::greater);
+		e.set_intrinsic(e.bind_function("arg gt arg", binary_op<intrinsic_op::greater>, function_flag::pure), intrinsic_op::greater);
+		e.set_intrinsic(e.bind_function("arg >= arg", binary_op<intrinsic_op::greater_equal>, function_flag::pure), intrinsic_op::greater_equal);
+		e.set_intrinsic(e.bind_function("arg ge arg", binary_op<intrinsic_op::greater_equal>, function_flag::pure), intrinsic_op::greater_equal);
+		e.set_intrinsic(e.bind_function("arg < arg", binary_op<intrinsic_op::less>, function_flag::pure), intrinsic_op::less);
+		e.set_intrinsic(e.bind_function("arg lt arg", binary_op<intrinsic_op::less>, function_flag::pure), intrinsic_op::less);
+		e.set_intrinsic(e.bind_function("arg <= arg", binary_op<intrinsic_op::less_equal>, function_flag::pure), intrinsic_op::less_equal);
+		e.set_intrinsic(e.bind_function("arg le arg", binary_op<intrinsic_op::less_equal>, function_flag::pure), intrinsic_op::less_equal);
+		e.set_intrinsic(e.bind_function("not arg", op_not, function_flag::pure), intrinsic_op::logical_not);
+
+		e.set_intrinsic(e.bind_function("arg + arg", binary_op<intrinsic_op::add>, function_flag::pure), intrinsic_op::add);
+		e.set_intrinsic(e.bind_function("arg - arg", binary_op<intrinsic_op::subtract>, function_flag::pure), intrinsic_op::subtract);
+		e.set_intrinsic(e.bind_function("arg * arg", binary_op<intrinsic_op::multiply>, function_flag::pure), intrinsic_op::multiply);
+		e.set_intrinsic(e.bind_function("arg / arg", binary_op<intrinsic_op::divide>, function_flag::pure), intrinsic_op::divide);
+		e.set_intrinsic(e.bind_function("arg % arg", binary_op<intrinsic_op::modulo>, function_flag::pure), intrinsic_op::modulo);
+
+		e.bind_function("arg is arg", op_is, function_flag::pure);
+		e.bind_function("type-of arg", type_of, function_flag::pure);
+		e.bind_function("typeof arg", type_of, function_flag::pure);
+		e.bind_function("size-of arg", size_of, function_flag::pure);
+		e.bind_function("sizeof arg", size_of, function_flag::pure);
+		e.bind_function("# arg", size_of, function_flag::pure);
+		e.bind_function("str arg", str, function_flag::pure);
+
+		e.set_intrinsic(e.bind_function("arg , arg+", op_cat, function_flag::pure), intrinsic_op::concatenate);
+		e.set_intrinsic(e.bind_function("arg and arg+", op_and, function_flag::pure), intrinsic_op::logical_and);
+		e.set_intrinsic(e.bind_function("arg or arg+", op_or, function_flag::pure), intrinsic_op::logical_or);
+		e.bind_function("list arg , arg*", list, function_flag::pure);
+		//e.bind_function("list", list);
+		e.set_intrinsic(e.bind_function("cat arg , arg* and arg", op_cat, function_flag::pure), intrinsic_op::concatenate);
+	
+		///e.bind_function("interpolate arg with arg?", 
+		e.bind_function("interpolate arg", [](context& e, std::vector<json> args) -> json {
+			return e.interpolate(e.eval_arg_steal(args, 0, json::value_t::string));
+		});
+		e.bind_function("parse arg", [](context& e, std::vector<json> args) -> json {
+			return e.parse(e.eval_arg_steal(args, 0, json::value_t::string));
+		});
+		e.bind_function("run arg", [](context& e, std::vector<json> args) -> json {
+			return e.interpolate_parsed(e.eval_arg_steal(args, 0, json::value_t::array));
+		});
+
+		/// TODO: 'default' should be optional
+		///e.bind_function("match arg with arg+ default arg?", [](context& e, std::vector<json> args) -> json {
+		///e.bind_function("match arg [with arg]+ [default arg]?", [](context& e, std::vector<json> args) -> json {
+		///e.bind_function("match arg [with arg]+ default arg", [](context& e, std::vector<json> args) -> json {
+		e.set_intrinsic(e.bind_function("match arg with arg* default arg", match), intrinsic_op::match);
+	}
+}
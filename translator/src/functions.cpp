@@ -12,8 +12,11 @@ namespace translator
 		return nullptr;
 	}
 
-	defined_function const* context::bind_function(std::string_view signature_spec, eval_func func)
+	defined_function const* context::bind_function(std::string_view signature_spec, eval_func func, function_flags flags)
 	{
+		if (!check_not_frozen("bind functions"))
+			return {};
+
 		if (!func)
 		{
 			report_error("cannot bind a null function");
@@ -63,7 +66,7 @@ namespace translator
 				return {};
 			}
 
-			return add_function(std::move(signature), std::move(func));
+			return add_function(signature, std::move(func), flags);
 		}
 
 		/// Verify parameter names
@@ -99,7 +102,7 @@ namespace translator
 			std::string_view param_decl = param_array[i + 1];
 
 			func_tree_element el;
-			el.name = std::move(prefix.get_ref<json::string_t&>());
+			el.name = symbols().intern(prefix.get_ref<json::string_t const&>());
 			el.modifier = 0;
 
 			if (param_decl.back() == one_or_more)
@@ -114,21 +117,146 @@ namespace translator
 		}
 
 		/// Actually create the function definition and attach it to the leaf element of the tree
-		return last_func_element->leaf = add_function(std::move(signature), std::move(func));
+		return last_func_element->leaf = add_function(signature, std::move(func), flags);
+	}
+
+	defined_function const* context::bind_function(std::string_view signature, native_eval_func func, function_flags flags)
+	{
+		if (!func)
+		{
+			report_error("cannot bind a null function");
+			return {};
+		}
+
+		/// Compatibility adapter for everything that calls functions with a vector of arguments
+		auto vector_func = [func](context& ctx, std::vector<json> arguments) { return func(ctx, { arguments.data(), arguments.size() }); };
+		const auto result = bind_function(signature, std::move(vector_func), flags);
+		if (result)
+		{
+			/// The definition is owned by this context
+			const_cast<defined_function*>(result)->native_func = std::move(func);
+		}
+		return result;
+	}
+
+	void context::check_native_arg_count(size_t arg_count, size_t param_count) const
+	{
+		if (arg_count == param_count)
+			return;
+		if (options.maintain_call_stack && !m_call_stack.empty())
+			throw_error(format("function {} requires {} arguments, {} given", m_call_stack.back().actual_function->signature, param_count, arg_count));
+		throw_error(format("function requires {} arguments, {} given", param_count, arg_count));
+	}
+
+	void context::report_native_arg_error(size_t arg_num, std::string_view expected_type, json const& value) const
+	{
+		if (options.maintain_call_stack && !m_call_stack.empty())
+		{
+			throw_error(format("argument {} to function {} must be of type {}, {} given",
+				arg_num, m_call_stack.back().actual_function->signature, expected_type, value.type_name()));
+		}
+		throw_error(format("argument {} to function must be of type {}, {} given", arg_num, expected_type, value.type_name()));
+	}
+
+	bool context::parameter_symbols(std::vector<json> const& arguments, std::vector<symbol>& parameter_names) const
+	{
+		/// Look up the parameter names in the symbol table once for all contexts;
+		/// a name that was never interned cannot be part of any function signature
+		const auto elem_count = arguments.size();
+		const bool infix = elem_count > 1 && (elem_count % 2) == 1;
+		auto const& symbols = this->symbols();
+		parameter_names.clear();
+		parameter_names.reserve(elem_count / 2 + 1);
+		for (size_t i = infix; i < elem_count; i += 2)
+		{
+			if (!arguments[i].is_string())
+				return false;
+			const auto name = symbols.find(arguments[i].get_ref<json::string_t const&>());
+			if (!name)
+				return false;
+			parameter_names.push_back(name);
+		}
+		return true;
+	}
+
+	bool context::parameter_symbols(tagged_value const& call, std::vector<symbol>& parameter_names) const
+	{
+		/// Words already carry their symbols
+		auto const& arguments = call.elements();
+		const auto elem_count = arguments.size();
+		const bool infix = elem_count > 1 && (elem_count % 2) == 1;
+		auto const& symbols = this->symbols();
+		parameter_names.clear();
+		parameter_names.reserve(elem_count / 2 + 1);
+		for (size_t i = infix; i < elem_count; i += 2)
+		{
+			const auto name = arguments[i].is_word() ? arguments[i].as_word()
+				: arguments[i].is_string() ? symbols.find(arguments[i].str())
+				: symbol{};
+			if (!name)
+				return false;
+			parameter_names.push_back(name);
+		}
+		return true;
 	}
 
 	std::vector<defined_function const*> context::find_functions(std::vector<json> const& arguments, bool only_in_local) const
 	{
-		auto candidates = find_local_functions(arguments);
-		if (!only_in_local && candidates.empty() && parent_context)
-			return parent()->find_functions(arguments, false);
-		return candidates;
+		std::vector<symbol> parameter_names;
+		if (!parameter_symbols(arguments, parameter_names))
+			return {};
+		return find_functions(parameter_names, arguments.size(), only_in_local);
+	}
+
+	defined_function const* context::dispatch(std::vector<symbol> const& parameter_names, size_t elem_count) const
+	{
+		/// Frozen contexts can be used by many threads at once, so they cannot update their index
+		if (m_frozen)
+		{
+			const auto candidates = find_functions(parameter_names, elem_count);
+			return candidates.size() == 1 ? candidates[0] : nullptr;
+		}
+
+		/// All the parents have children, so the epoch changes whenever a function is bound in any of them;
+		/// both only ever grow, so their sum changes whenever either does
+		if (const auto generation = m_bind_generation + m_root->m_bind_epoch.load(std::memory_order_relaxed); generation != m_dispatch_generation)
+		{
+			m_dispatch_index.clear();
+			m_dispatch_generation = generation;
+		}
+
+		/// The key is the kind of call (no-argument, infix or prefix) followed by the symbols of its parameter names
+		auto& key = m_dispatch_key;
+		key.clear();
+		key += char32_t(elem_count == 1 ? 0 : (elem_count % 2) ? 1 : 2);
+		for (auto name : parameter_names)
+			key += char32_t(name.id);
+
+		if (auto it = m_dispatch_index.find(key); it != m_dispatch_index.end())
+		{
+			++m_function_cache_stats.hits;
+			return it->second;
+		}
+
+		++m_function_cache_stats.misses;
+		const auto candidates = find_functions(parameter_names, elem_count);
+		const auto result = candidates.size() == 1 ? candidates[0] : nullptr;
+		m_dispatch_index.emplace(key, result);
+		return result;
+	}
+
+	std::vector<defined_function const*> context::find_functions(std::vector<symbol> const& parameter_names, size_t elem_count, bool only_in_local) const
+	{
+		std::set<defined_function const*> result;
+		for (auto ctx = this; ctx && result.empty(); ctx = only_in_local ? nullptr : ctx->parent())
+			ctx->find_local_functions(parameter_names, elem_count, result);
+		return { result.begin(), result.end() };
 	}
 
 	void context::find_local_functions(
 		tree_type const& tree,
-		std::vector<json>::const_iterator arg_name_it,
-		std::vector<json>::const_iterator arg_names_end,
+		symbol const* arg_name_it,
+		symbol const* arg_names_end,
 		std::set<defined_function const*>& found
 	) const
 	{
@@ -139,7 +267,7 @@ namespace translator
 			const auto [arg_name_it, in_tree] = subtrees_to_consider.back();
 			subtrees_to_consider.pop_back();
 
-			std::vector<std::pair<std::vector<json>::const_iterator, tree_type::const_iterator>> new_candidates;
+			std::vector<std::pair<symbol const*, tree_type::const_iterator>> new_candidates;
 
 			/// Look for functions with optional parameters at this point
 			for (auto it = in_tree->begin(); it != in_tree->end(); ++it)
@@ -151,14 +279,14 @@ namespace translator
 			/// If we have more argument names given, search tree for subtrees that start with the next argument name
 			if (arg_name_it != arg_names_end)
 			{
-				auto [begin, end] = in_tree->equal_range(std::string_view{ *arg_name_it });
+				auto [begin, end] = in_tree->equal_range(*arg_name_it);
 				for (auto subtree = begin; subtree != end; ++subtree)
 				{
-					auto next_name = arg_name_it + 2;
+					auto next_name = arg_name_it + 1;
 					if (subtree->modifier == '+' || subtree->modifier == '*') /// Variadic parameters
 					{
 						while (next_name != arg_names_end && *next_name == subtree->name)
-							next_name += 2;
+							++next_name;
 					}
 					new_candidates.push_back({ next_name, subtree });
 				}
@@ -176,35 +304,161 @@ namespace translator
 		}
 	}
 
-	std::vector<defined_function const*> context::find_local_functions(std::vector<json> const& arguments) const
+	void context::find_local_functions(std::vector<symbol> const& parameter_names, size_t elem_count, std::set<defined_function const*>& result) const
 	{
-		std::set<defined_function const*> result;
-		if (arguments.size() == 1) /// no args
+		const auto names_begin = parameter_names.data();
+		const auto names_end = names_begin + parameter_names.size();
+		if (elem_count == 1) /// no args
 		{
-			if (auto it = m_functions_by_sig.find(arguments[0]); it != m_functions_by_sig.end())
+			/// The signature of a no-args function is its name
+			if (auto it = m_functions_by_sig.find(parameter_names[0]); it != m_functions_by_sig.end())
 				result.insert(&it->second);
 
-			if (auto it = m_prefix_function_tree.find(std::string_view{ arguments[0] }); it != m_prefix_function_tree.end())
+			if (auto it = m_prefix_function_tree.find(parameter_names[0]); it != m_prefix_function_tree.end())
 			{
 				if ((it->modifier == '?' || it->modifier == '*') && it->leaf)
 					result.insert(it->leaf);
 			}
 		}
-		else if (arguments.size() % 2) /// infix
-			find_local_functions(m_infix_function_tree, arguments.begin() + 1, arguments.end(), result);
+		else if (elem_count % 2) /// infix
+			find_local_functions(m_infix_function_tree, names_begin, names_end, result);
 		else /// prefix
-			find_local_functions(m_prefix_function_tree, arguments.begin() + 0, arguments.end(), result);
-		return { result.begin(), result.end() };
+			find_local_functions(m_prefix_function_tree, names_begin, names_end, result);
 	}
 
-	defined_function* context::add_function(std::string signature, eval_func func)
+	void context::set_intrinsic(defined_function const* func, intrinsic_op op)
 	{
-		auto& definition = this->m_functions_by_sig[signature];
+		if (!func || !check_not_frozen("set intrinsics"))
+			return;
+
+		const auto it = std::find_if(m_functions_by_sig.begin(), m_functions_by_sig.end(), [func](auto const& pair) { return &pair.second == func; });
+		if (it == m_functions_by_sig.end())
+		{
+			report_error(format("function '{}' is not bound in this context", func->signature));
+			return;
+		}
+
+		it->second.intrinsic = op;
+		next_bind_generation();
+	}
+
+	defined_function* context::add_function(std::string_view signature, eval_func func, function_flags flags)
+	{
+		next_bind_generation();
+		auto& symbols = this->symbols();
+		const auto signature_symbol = symbols.intern(signature);
+		auto& definition = this->m_functions_by_sig[signature_symbol];
 		if (definition.func)
 			assert(definition.signature == signature);
 		else
-			definition.signature = std::move(signature);
+			definition.signature = symbols.name(signature_symbol);
 		definition.func = std::move(func);
+		definition.native_func = {};
+		definition.flags = flags;
+		definition.intrinsic = intrinsic_op::none;
 		return &definition;
 	}
-}
\ No newline at end of file
+
+	void context::begin_profiled_call(defined_function const* func, size_t arg_count)
+	{
+		auto& profile = m_function_profiles[func];
+		profile.signature = func->signature;
+		++profile.calls;
+		++profile.calls_by_arg_count[std::min(arg_count, function_profile::arg_count_buckets - 1)];
+		m_profiled_calls.push_back({ &profile, std::chrono::steady_clock::now() });
+	}
+
+	void context::end_profiled_call() noexcept
+	{
+		const auto call = m_profiled_calls.back();
+		m_profiled_calls.pop_back();
+		const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - call.start);
+		call.profile->inclusive_time += elapsed;
+		call.profile->exclusive_time += elapsed - call.callee_time;
+		if (!m_profiled_calls.empty())
+			m_profiled_calls.back().callee_time += elapsed;
+	}
+
+	std::vector<function_profile> context::function_profiles() const
+	{
+		/// Functions of different contexts can have the same signature
+		std::unordered_map<std::string_view, function_profile> merged;
+		for (auto const& [func, profile] : m_function_profiles)
+		{
+			auto& result = merged[profile.signature];
+			result.signature = profile.signature;
+			result.merge(profile);
+		}
+		if (!parent_context)
+		{
+			std::lock_guard lock{ m_flushed_profiles_mutex };
+			for (auto const& [signature, profile] : m_flushed_profiles)
+			{
+				auto& result = merged[signature];
+				result.signature = signature;
+				result.merge(profile);
+			}
+		}
+
+		std::vector<function_profile> result;
+		result.reserve(merged.size());
+		for (auto& [signature, profile] : merged)
+			result.push_back(std::move(profile));
+		std::sort(result.begin(), result.end(), [](function_profile const& a, function_profile const& b) {
+			return a.exclusive_time != b.exclusive_time ? a.exclusive_time > b.exclusive_time : a.signature < b.signature;
+		});
+		return result;
+	}
+
+	void context::flush_function_profiles()
+	{
+		if (!parent_context || m_function_profiles.empty() || !m_profiled_calls.empty())
+			return;
+
+		auto const& root = *get_root_context();
+		{
+			std::lock_guard lock{ root.m_flushed_profiles_mutex };
+			for (auto const& [func, profile] : m_function_profiles)
+			{
+				auto& flushed = root.m_flushed_profiles[profile.signature];
+				flushed.signature = profile.signature;
+				flushed.merge(profile);
+			}
+		}
+		m_function_profiles.clear();
+	}
+
+	void context::reset_function_profiles()
+	{
+		if (!m_profiled_calls.empty())
+			return;
+		m_function_profiles.clear();
+		if (!parent_context)
+		{
+			std::lock_guard lock{ m_flushed_profiles_mutex };
+			m_flushed_profiles.clear();
+		}
+	}
+
+	void context::next_bind_generation() noexcept
+	{
+		++m_bind_generation;
+		if (m_has_children)
+			m_root->m_bind_epoch.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint64_t context::bind_generation() const noexcept
+	{
+		/// Generations only ever grow, so their sum changes whenever any of them does
+		uint64_t result = 0;
+		for (auto ctx = this; ctx; ctx = ctx->parent())
+			result += ctx->m_bind_generation;
+		return result;
+	}
+
+	void context::clear_function_cache()
+	{
+		m_dispatch_index.clear();
+		m_function_cache_stats = {};
+	}
+}
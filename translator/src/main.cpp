@@ -3,6 +3,8 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <thread>
 #include <gtest/gtest.h>
 
 using namespace translator;
@@ -11,208 +13,6 @@ using namespace std::string_view_literals;
 struct e_break : context::e_scope_terminator { virtual std::string type() const noexcept override { return "break"; } };
 struct e_continue : context::e_scope_terminator { virtual std::string type() const noexcept override { return "continue"; } };
 
-static inline json if_then_else(context& e, std::vector<json> args)
-{
-	e.assert_args(args, 3);
-	if (is_true(e.eval_arg_steal(args, 0)))
-		return e.eval_arg_steal(args, 1);
-	return e.eval_arg_steal(args, 2);
-}
-
-static inline json op_is(context& e, std::vector<json> args)
-{
-	e.eval_args(args, 2);
-	e.assert_arg(args, 1, json::value_t::string);
-	return args[0].type_name() == args[1];
-}
-
-static inline json op_eq(context& e, std::vector<json> args) { 
-	e.eval_args(args, 2);  
-	return args[0] == args[1]; 
-}
-static inline json op_neq(context& e, std::vector<json> args) { e.eval_args(args, 2); return args[0] != args[1]; }
-static inline json op_gt(context& e, std::vector<json> args) { e.eval_args(args, 2);  return args[0] > args[1]; }
-static inline json op_ge(context& e, std::vector<json> args) { e.eval_args(args, 2);  return args[0] >= args[1]; }
-static inline json op_lt(context& e, std::vector<json> args) { e.eval_args(args, 2);  return args[0] < args[1]; }
-static inline json op_le(context& e, std::vector<json> args) { e.eval_args(args, 2);  return args[0] <= args[1]; }
-
-static inline json op_not(context& e, std::vector<json> args) { e.eval_args(args, 1);  return !is_true(args[0]); }
-static inline json op_and(context& e, std::vector<json> args) {
-	e.assert_min_args(args, 2);
-	json left;
-	for (size_t i = 0; i < args.size(); ++i)
-	{
-		left = e.eval_arg_steal(args, i);
-		if (!is_true(left))
-			return left;
-	}
-	return left;
-}
-static inline json op_or(context& e, std::vector<json> args) {
-	e.assert_min_args(args, 2);
-	json left;
-	for (size_t i = 0; i < args.size(); ++i)
-	{
-		left = e.eval_arg_steal(args, i);
-		if (is_true(left))
-			return left;
-	}
-	return left;
-}
-
-#define IMPL_OPF(lhs, op, rhs) \
-	const auto lhs_type = lhs.type();                                                                    \
-	const auto rhs_type = rhs.type();                                                                    \
-	if (lhs_type == json::value_t::number_integer && rhs_type == json::value_t::number_float) \
-		return static_cast<json::number_float_t>(lhs) op (json::number_float_t)rhs;      \
-	else if (lhs_type == json::value_t::number_float && rhs_type == json::value_t::number_integer)                   \
-		return (json::number_float_t)lhs op static_cast<json::number_float_t>(rhs);          \
-	else if (lhs_type == json::value_t::number_unsigned && rhs_type == json::value_t::number_float)                  \
-		return static_cast<json::number_float_t>(lhs) op (json::number_float_t)rhs;         \
-	else if (lhs_type == json::value_t::number_float && rhs_type == json::value_t::number_unsigned)                  \
-		return (json::number_float_t)lhs op static_cast<json::number_float_t>(rhs);         \
-	else if (lhs_type == json::value_t::number_unsigned && rhs_type == json::value_t::number_integer)                \
-		return static_cast<json::number_integer_t>(lhs) op (json::number_integer_t)rhs;     \
-	else if (lhs_type == json::value_t::number_integer && rhs_type == json::value_t::number_unsigned)                \
-		return (json::number_integer_t)lhs op static_cast<json::number_integer_t>(rhs);     \
-	else return 0;
-
-#define IMPL_OPI(lhs, op, rhs) \
-	const auto lhs_type = lhs.type();                                                                    \
-	const auto rhs_type = rhs.type();                                                                    \
-	if (lhs_type == json::value_t::number_unsigned && rhs_type == json::value_t::number_integer)                \
-		return static_cast<json::number_integer_t>(lhs) op (json::number_integer_t)rhs;     \
-	else if (lhs_type == json::value_t::number_integer && rhs_type == json::value_t::number_unsigned)                \
-		return (json::number_integer_t)lhs op static_cast<json::number_integer_t>(rhs);     \
-	else return 0;
-
-static inline json op_plus(context& e, std::vector<json> args) { e.eval_args(args, 2);  IMPL_OPF(args[0], +, args[1]); }
-static inline json op_minus(context& e, std::vector<json> args) { e.eval_args(args, 2); IMPL_OPF(args[0], -, args[1]); }
-static inline json op_mul(context& e, std::vector<json> args) { e.eval_args(args, 2);   IMPL_OPF(args[0], *, args[1]); }
-static inline json op_div(context& e, std::vector<json> args) { e.eval_args(args, 2);   IMPL_OPF(args[0], /, args[1]); }
-static inline json op_mod(context& e, std::vector<json> args) { e.eval_args(args, 2);   IMPL_OPI(args[0], %, args[1]); }
-
-static inline json type_of(context& e, std::vector<json> args) {
-	const auto val = e.eval_arg_steal(args, 0);
-	return val.type_name();
-}
-
-static inline json size_of(context& e, std::vector<json> args) {
-	const auto val = e.eval_arg_steal(args, 0);
-	const json& j = val;
-	return j.is_string() ? j.get_ref<json::string_t const&>().size() : j.size();
-}
-
-static inline json str(context& e, std::vector<json> args)
-{
-	auto arg = e.eval_arg_steal(args, 0);
-	return e.value_to_string(arg);
-}
-
-/// Will evaluate each argument and return the last one
-static inline json eval(context& e, std::vector<json> args)
-{
-	json last = nullptr;
-	for (size_t i = 0; i < args.size(); ++i)
-		last = e.eval(std::move(args[i]));
-	return last;
-}
-
-/// Will evaluate each argument and return a list of the results
-static inline json list(context& e, std::vector<json> args)
-{
-	e.eval_args(args);
-	std::vector<json> result;
-	for (size_t i = 0; i < args.size(); ++i)
-		result.push_back(std::move(args[i]));
-	return result;
-}
-
-/// Will evaluate each argument and concatenate them in a string
-static inline json op_cat(context& e, std::vector<json> args)
-{
-	e.eval_args(args);
-	std::string result;
-	for (size_t i = 0; i < args.size(); ++i)
-		result += e.value_to_string(args[i]);
-	return result;
-}
-
-void open_core_lib(context& e)
-{
-	/// TODO: [pred .kills with [one? 'bla'], [zero? 'bleh'], [many? 'bluh']]
-	
-	e.bind_function("if arg then arg else arg", if_then_else);
-	e.bind_function("arg ? arg : arg", if_then_else);
-
-	e.bind_function("arg == arg", op_eq);
-	e.bind_function("arg eq arg", op_eq);
-	e.bind_function("arg != arg", op_neq);
-	e.bind_function("arg neq arg", op_neq);
-	e.bind_function("arg > arg", op_gt);
-	e.bind_function("arg gt arg", op_gt);
-	e.bind_function("arg >= arg", op_ge);
-	e.bind_function("arg ge arg", op_ge);
-	e.bind_function("arg < arg", op_lt);
-	e.bind_function("arg lt arg", op_lt);
-	e.bind_function("arg <= arg", op_le);
-	e.bind_function("arg le arg", op_le);
-	e.bind_function("not arg", op_not);
-
-	e.bind_function("arg + arg", op_plus);
-	e.bind_function("arg - arg", op_minus);
-	e.bind_function("arg * arg", op_mul);
-	e.bind_function("arg / arg", op_div);
-	e.bind_function("arg % arg", op_mod);
-
-	e.bind_function("arg is arg", op_is);
-	e.bind_function("type-of arg", type_of);
-	e.bind_function("typeof arg", type_of);
-	e.bind_function("size-of arg", size_of);
-	e.bind_function("sizeof arg", size_of);
-	e.bind_function("# arg", size_of);
-	e.bind_function("str arg", str);
-
-	e.bind_function("arg , arg+", op_cat);
-	e.bind_function("arg and arg+", op_and);
-	e.bind_function("arg or arg+", op_or);
-	e.bind_function("list arg , arg*", list);
-	//e.bind_function("list", list);
-	e.bind_function("cat arg , arg* and arg", op_cat);
-	
-	///e.bind_function("interpolate arg with arg?", 
-	e.bind_function("interpolate arg", [](context& e, std::vector<json> args) -> json {
-		return e.interpolate(e.eval_arg_steal(args, 0, json::value_t::string));
-	});
-	e.bind_function("parse arg", [](context& e, std::vector<json> args) -> json {
-		return e.parse(e.eval_arg_steal(args, 0, json::value_t::string));
-	});
-	e.bind_function("run arg", [](context& e, std::vector<json> args) -> json {
-		return e.interpolate_parsed(e.eval_arg_steal(args, 0, json::value_t::array));
-	});
-
-	/// TODO: 'default' should be optional
-	///e.bind_function("match arg with arg+ default arg?", [](context& e, std::vector<json> args) -> json {
-	///e.bind_function("match arg [with arg]+ [default arg]?", [](context& e, std::vector<json> args) -> json {
-	///e.bind_function("match arg [with arg]+ default arg", [](context& e, std::vector<json> args) -> json {
-	e.bind_function("match arg with arg* default arg", [](context& e, std::vector<json> args) -> json {
-		e.assert_min_args(args, 2);
-		auto val = e.eval_arg_steal(args, 0);
-		for (size_t i = 1; i < args.size() - 1; i++)
-		{
-			e.assert_arg(args, i, json::value_t::array);
-			auto& match_case = args[i];
-			if (match_case.size() < 2)
-				return e.report_error(format("case #{} in match must have at least 2 arguments", i));
-			auto case_val = e.eval(move(match_case[0]));
-			if (val == case_val)
-				return e.eval(move(match_case[1]));
-		}
-		return e.eval_arg_steal(args, args.size() - 1);
-	});
-}
-
-
 struct translator_f : public testing::Test {
 	translator_f() {
 		open_core_lib(ctx);
@@ -240,6 +40,45 @@ TEST_F(translator_f, capi_works)
 	auto result = translator_interpolate_str(cctx, "hello world [.asd]");
 	EXPECT_EQ(result, "hello world booba"sv);
 	free((void*)result);
+
+	char buffer[32];
+	EXPECT_EQ(translator_interpolate_to(cctx, "hello world [.asd]", buffer, sizeof(buffer)), buffer);
+	EXPECT_EQ(buffer, "hello world booba"sv);
+	EXPECT_EQ(translator_interpolate_to(cctx, "hello world [.asd]", buffer, 8), nullptr);
+}
+
+TEST_F(translator_f, interpolating_to_sinks_works)
+{
+	ctx.set_user_var("kills", 2);
+	ctx.set_user_var("items", json::array({ 1, "sword", true, nullptr }));
+	const auto str = "Killed [.kills] [ [.kills == 1] ? monster. : monsters. ] [[[.items]]"sv;
+	const auto expected = "Killed 2 monsters. [[1 sword true <null>]]"sv;
+
+	std::string result = "> ";
+	output_sink string_sink{ result };
+	ctx.interpolate_to(string_sink, str);
+	EXPECT_EQ(result, "> " + std::string{ expected });
+
+	char buffer[16];
+	output_sink buffer_sink{ buffer };
+	ctx.interpolate_to(buffer_sink, str);
+	EXPECT_TRUE(buffer_sink.truncated());
+	EXPECT_EQ(buffer_sink.size(), expected.size());
+	EXPECT_EQ(buffer, expected.substr(0, 15));
+
+	std::string written;
+	output_sink callback_sink{ [](void* user_data, char const* data, size_t size) { static_cast<std::string*>(user_data)->append(data, size); }, &written };
+	ctx.interpolate_parsed_to(callback_sink, ctx.parse(str));
+	EXPECT_EQ(written, expected);
+
+	std::string compiled_result;
+	output_sink compiled_sink{ compiled_result };
+	ctx.interpolate_compiled_to(compiled_sink, ctx.compile(ctx.parse(str)));
+	EXPECT_EQ(compiled_result, expected);
+
+	/// Custom string conversions are still used when rendering to sinks
+	ctx.json_value_to_string_func() = [](context const& c, json const& j) -> std::string { return j.is_number() ? "#" : context::default_json_value_to_str_func(c, j); };
+	EXPECT_EQ(ctx.interpolate(str), "Killed # monsters. [[# sword true <null>]]");
 }
 
 TEST_F(translator_f, variadic_arguments_work)
@@ -271,6 +110,1049 @@ TEST_F(translator_f, preparse_works)
 	EXPECT_EQ("Killed 20 monsters.", ctx.interpolate_parsed(std::move(parsed)));
 }
 
+TEST_F(translator_f, compiled_templates_work)
+{
+	auto compiled = ctx.compile(ctx.parse("Killed [.kills] [ [.kills == 1] ? monster. : monsters. ][][a, b]"));
+	EXPECT_FALSE(compiled.empty());
+	ctx.set_user_var("kills", 2);
+	EXPECT_EQ("Killed 2 monsters.<null>ab", ctx.interpolate_compiled(compiled));
+	ctx.set_user_var("kills", 1);
+	EXPECT_EQ("Killed 1 monster.<null>ab", ctx.interpolate_compiled(compiled));
+
+	/// Calls that cannot be resolved at compile time are resolved (or reported) when run
+	auto late_bound = ctx.compile(ctx.parse("[greet .kills]"));
+	EXPECT_THROW(ctx.interpolate_compiled(late_bound), std::runtime_error);
+	ctx.bind_function("greet arg", [](context& e, std::vector<json> args) -> json {
+		return "hello " + e.value_to_string(e.eval_arg_steal(args, 0));
+	});
+	EXPECT_EQ("hello 1", ctx.interpolate_compiled(late_bound));
+
+	/// Compiled templates can be run from within a function run by another compiled template
+	ctx.set_user_var("inner", "[.kills == 1]");
+	EXPECT_EQ("true/1", ctx.interpolate_compiled(ctx.compile(ctx.parse("[interpolate .inner]/[.kills]"))));
+
+	/// Templates whose functions were rebound since they were compiled are interpreted, until they are recompiled
+	auto greeting = ctx.compile(ctx.parse("[greet .kills]"));
+	EXPECT_TRUE(ctx.is_current(greeting));
+	ctx.bind_function("greet arg", [](context& e, std::vector<json> args) -> json {
+		return "hi " + e.value_to_string(e.eval_arg_steal(args, 0));
+	});
+	EXPECT_FALSE(ctx.is_current(greeting));
+	EXPECT_EQ("hi 1", ctx.interpolate_compiled(greeting));
+	/// The recompiled template is kept, and shared by copies
+	ASSERT_TRUE(greeting.relinked->compiled);
+	const auto relinked = greeting.relinked->compiled;
+	EXPECT_TRUE(ctx.is_current(*relinked));
+	const auto greeting_copy = greeting;
+	EXPECT_EQ("hi 1", ctx.interpolate_compiled(greeting_copy));
+	EXPECT_EQ(relinked, greeting.relinked->compiled);
+	ctx.bind_function("greet arg", [](context& e, std::vector<json> args) -> json {
+		return "hey " + e.value_to_string(e.eval_arg_steal(args, 0));
+	});
+	EXPECT_EQ("hey 1", ctx.interpolate_compiled(greeting));
+	EXPECT_NE(relinked, greeting.relinked->compiled);
+
+	/// Templates can be run in children of the context they were compiled in, but not anywhere else
+	context child{ &ctx };
+	EXPECT_EQ("Killed 1 monster.<null>ab", child.interpolate_compiled(compiled));
+	context other;
+	other.error_handler() = ctx.error_handler();
+	EXPECT_THROW(other.interpolate_compiled(compiled), std::runtime_error);
+}
+
+TEST_F(translator_f, tagged_values_work)
+{
+	EXPECT_EQ(sizeof(tagged_value), 16);
+
+	tagged_value short_str{ "short" };
+	tagged_value long_str{ "a string too long to be stored inline" };
+	auto copy = long_str;
+	EXPECT_EQ(copy.str(), long_str.str());
+	auto moved = std::move(copy);
+	EXPECT_TRUE(copy.is_null());
+	EXPECT_EQ(moved.str(), "a string too long to be stored inline");
+	EXPECT_EQ(short_str.str(), "short");
+
+	auto& symbols = ctx.symbols();
+	auto call = tagged_value::make_call({ tagged_value::make_word(symbols.intern("not")), true });
+	EXPECT_EQ(call.to_json(symbols), json::array({ "not", true }));
+	EXPECT_TRUE(tagged_value::from_json(call.to_json(symbols)).is_array());
+
+	auto error = tagged_value::make_error("oops");
+	auto error_json = error.to_json(symbols);
+	EXPECT_TRUE(error_json.is_binary());
+	EXPECT_TRUE(tagged_value::from_json(error_json).is_error());
+	EXPECT_EQ(tagged_value::from_json(error_json).str(), "oops");
+
+	auto parsed = ctx.parse_value("Killed [.kills] [ [.kills == 1] ? monster. : monsters. ]");
+	ASSERT_TRUE(parsed.is_array());
+	ASSERT_EQ(parsed.elements().size(), 4);
+	EXPECT_TRUE(parsed.elements()[1].is_call());
+	EXPECT_TRUE(parsed.elements()[1].elements()[0].is_word());
+	EXPECT_TRUE(parsed.elements()[3].elements()[0].is_call());
+	EXPECT_EQ(parsed.to_json(symbols), ctx.parse("Killed [.kills] [ [.kills == 1] ? monster. : monsters. ]"));
+
+	auto compiled = ctx.compile(parsed);
+	ctx.set_user_var("kills", 1);
+	EXPECT_EQ("Killed 1 monster.", ctx.interpolate_compiled(compiled));
+}
+
+TEST_F(translator_f, parsed_templates_use_their_arena)
+{
+	struct counting_resource : std::pmr::memory_resource
+	{
+		size_t allocations = 0;
+		void* do_allocate(size_t bytes, size_t alignment) override { ++allocations; return std::pmr::new_delete_resource()->allocate(bytes, alignment); }
+		void do_deallocate(void* p, size_t bytes, size_t alignment) override { std::pmr::new_delete_resource()->deallocate(p, bytes, alignment); }
+		bool do_is_equal(memory_resource const& other) const noexcept override { return this == &other; }
+	} upstream;
+
+	const auto source = "You have killed [.kills] monsters with your [ [.weapon] or 'a weapon that is way too long to store inline' ] [[and nothing else]"sv;
+	{
+		auto parsed = ctx.parse_template(source, &upstream);
+		EXPECT_TRUE(parsed.root().is_borrowed());
+		EXPECT_TRUE(parsed.root().elements()[0].is_borrowed());
+		EXPECT_LE(upstream.allocations, 2);
+		EXPECT_EQ(parsed.root().to_json(ctx.symbols()), ctx.parse(source));
+
+		/// Copies do not depend on the arena
+		auto copy = parsed.root();
+		EXPECT_FALSE(copy.is_borrowed());
+		EXPECT_FALSE(copy.elements()[0].is_borrowed());
+
+		ctx.set_user_var("kills", 5);
+		ctx.set_user_var("weapon", "sword");
+		EXPECT_EQ("You have killed 5 monsters with your sword [and nothing else]", ctx.interpolate_compiled(ctx.compile(parsed.root())));
+	}
+}
+
+TEST_F(translator_f, parsed_templates_refer_to_their_source)
+{
+	const auto source = "A long piece of literal text [.weapon] followed by [[escaped text] and ['a string without escapes' 'an \\'escaped\\' string']"sv;
+	auto parsed = ctx.parse_template(source);
+	EXPECT_EQ(parsed.source(), source);
+	EXPECT_NE(parsed.source().data(), source.data());
+	EXPECT_EQ(parsed.root().to_json(ctx.symbols()), ctx.parse(source));
+
+	const auto in_source = [&](tagged_value const& val) {
+		const auto str = val.str();
+		return str.data() >= parsed.source().data() && str.data() + str.size() <= parsed.source().data() + parsed.source().size();
+	};
+	auto const& elements = parsed.root().elements();
+	ASSERT_EQ(elements.size(), 4);
+	EXPECT_TRUE(in_source(elements[0]));
+	EXPECT_EQ(elements[2].str(), " followed by [escaped text] and ");
+	EXPECT_FALSE(in_source(elements[2]));
+	EXPECT_TRUE(in_source(elements[3].elements()[0]));
+	EXPECT_EQ(elements[3].elements()[1].str(), "an 'escaped' string");
+	EXPECT_FALSE(in_source(elements[3].elements()[1]));
+}
+
+TEST_F(translator_f, catalogs_work)
+{
+	catalog messages{ ctx };
+	messages.load(json{
+		{ "kills", "Killed [.kills] [ [.kills == 1] ? monster. : monsters. ]" },
+		{ "greeting", "[greet .name]" },
+	});
+	EXPECT_EQ(messages.size(), 2);
+
+	ctx.set_user_var("kills", 1);
+	EXPECT_EQ(messages.translate("kills"), "Killed 1 monster.");
+	const auto kills = messages.find("kills");
+	ASSERT_TRUE(kills);
+	ctx.set_user_var("kills", 3);
+	std::string result;
+	output_sink sink{ result };
+	messages.translate(kills, sink);
+	EXPECT_EQ(result, "Killed 3 monsters.");
+
+	EXPECT_FALSE(messages.find("nonexistent"));
+	EXPECT_THROW(messages.translate("nonexistent"), std::runtime_error);
+
+	/// Messages are recompiled when new functions are bound
+	ctx.set_user_var("name", "Bob");
+	EXPECT_THROW(messages.translate("greeting"), std::runtime_error);
+	ctx.bind_function("greet arg", [](context& e, std::vector<json> args) -> json {
+		return "Hello, " + e.value_to_string(e.eval_arg_steal(args, 0));
+	});
+	EXPECT_EQ(messages.translate("greeting"), "Hello, Bob");
+
+	/// Replacing a message keeps its id
+	EXPECT_EQ(messages.add("kills", "[.kills] kills").index, kills.index);
+	EXPECT_EQ(messages.translate(kills), "3 kills");
+
+	const auto path = std::filesystem::temp_directory_path() / "translator_catalog_test.json";
+	std::ofstream{ path } << R"({ "farewell": "Bye, [.name]!" })";
+	messages.load_file(path);
+	std::filesystem::remove(path);
+	EXPECT_EQ(messages.size(), 3);
+	EXPECT_EQ(messages.translate("farewell"), "Bye, Bob!");
+
+	EXPECT_THROW(messages.load_file(path), std::runtime_error);
+}
+
+TEST_F(translator_f, binary_catalogs_work)
+{
+	ctx.bind_function("list arg , arg*", [](context& e, std::vector<json> args) -> json { return json(std::move(args)).dump(); });
+
+	catalog messages{ ctx };
+	messages.load(json{
+		{ "kills", "Killed [.kills] [ [.kills == 1] ? monster. : monsters. ]" },
+		{ "list", "[list 1, -2, 3.5, true, null, [1 2]] [[escaped]" },
+	});
+
+	std::ostringstream out;
+	messages.save_binary(out);
+	const auto image = out.str();
+
+	/// Mapped from a file
+	const auto path = std::filesystem::temp_directory_path() / "translator_catalog_test.trcb";
+	std::ofstream{ path, std::ios::binary } << image;
+	{
+		catalog mapped{ ctx };
+		mapped.map_binary_file(path);
+		EXPECT_EQ(mapped.size(), 2);
+		ctx.set_user_var("kills", 1);
+		EXPECT_EQ(mapped.translate("kills"), "Killed 1 monster.");
+		ctx.set_user_var("kills", 2);
+		EXPECT_EQ(mapped.translate("kills"), "Killed 2 monsters.");
+		EXPECT_EQ(mapped.translate("list"), R"([1,-2,3.5,true,null,[1,2]] [escaped])");
+	}
+	std::filesystem::remove(path);
+	EXPECT_THROW(catalog{ ctx }.map_binary_file(path), std::runtime_error);
+
+	/// Used in place from memory
+	std::vector<uint64_t> buffer((image.size() + 7) / 8);
+	std::memcpy(buffer.data(), image.data(), image.size());
+	catalog loaded{ ctx };
+	loaded.load_binary(buffer.data(), image.size());
+	EXPECT_EQ(loaded.translate("list"), messages.translate("list"));
+
+	/// Invalid data
+	EXPECT_THROW(loaded.load_binary(buffer.data(), 8), std::runtime_error);
+	buffer[0] = 0;
+	EXPECT_THROW(loaded.load_binary(buffer.data(), image.size()), std::runtime_error);
+}
+
+TEST_F(translator_f, binary_catalogs_reject_invalid_nodes)
+{
+	catalog messages{ ctx };
+	messages.load(json{
+		{ "kills", "Killed [.kills] [ [.kills == 1] ? monster. : monsters. ]" },
+		{ "list", "[.kills]" },
+	});
+	std::ostringstream out;
+	messages.save_binary(out);
+	const auto image = out.str();
+
+	/// Offsets of the header fields, and the layouts of messages and nodes, as written by `save_binary`
+	struct message { uint64_t id_offset; uint32_t id_length; uint32_t root_node; };
+	struct node { tagged_value::kind type; uint8_t reserved[3]; uint32_t count; uint64_t payload; };
+	const auto corrupted = [&](auto&& corrupt) {
+		std::vector<uint64_t> buffer((image.size() + 7) / 8);
+		std::memcpy(buffer.data(), image.data(), image.size());
+		auto const* bytes = reinterpret_cast<char*>(buffer.data());
+		uint64_t messages_offset{}, nodes_offset{};
+		std::memcpy(&messages_offset, bytes + 24, sizeof(messages_offset));
+		std::memcpy(&nodes_offset, bytes + 32, sizeof(nodes_offset));
+		corrupt(reinterpret_cast<message*>(buffer.data() + messages_offset / 8), reinterpret_cast<node*>(buffer.data() + nodes_offset / 8));
+		return buffer;
+	};
+
+	/// A message whose id is out of bounds is skipped
+	{
+		auto buffer = corrupted([](message* msgs, node*) { msgs[1].id_offset = ~uint32_t{}; });
+		ctx.options.errors_as_values = true;
+		catalog loaded{ ctx };
+		loaded.load_binary(buffer.data(), image.size());
+		ctx.options.errors_as_values = false;
+		EXPECT_EQ(loaded.size(), 1);
+		ASSERT_FALSE(ctx.errors().empty());
+		EXPECT_EQ(ctx.errors().back().message, "invalid id of message 1 in binary catalog");
+		ctx.clear_errors();
+	}
+
+	/// A list whose elements overlap those of a list decoded before it is rejected, as such lists could make decoding take exponential time
+	{
+		auto buffer = corrupted([](message* msgs, node* nodes) {
+			auto const& root = nodes[msgs[0].root_node];
+			auto& kills = nodes[root.payload + 1];
+			auto& condition = nodes[root.payload + 3];
+			ASSERT_EQ(kills.type, tagged_value::kind::call);
+			ASSERT_EQ(condition.type, tagged_value::kind::call);
+			condition.payload = kills.payload;
+		});
+		catalog loaded{ ctx };
+		loaded.load_binary(buffer.data(), image.size());
+		ctx.set_user_var("kills", 1);
+		EXPECT_EQ(loaded.translate("list"), "1");
+		EXPECT_THROW(loaded.translate("kills"), std::runtime_error);
+	}
+
+	/// As is a word that is out of bounds
+	{
+		auto buffer = corrupted([](message* msgs, node* nodes) {
+			auto const& root = nodes[msgs[1].root_node];
+			auto& var = nodes[nodes[root.payload].payload];
+			ASSERT_EQ(var.type, tagged_value::kind::word);
+			var.count = ~uint32_t{};
+		});
+		catalog loaded{ ctx };
+		loaded.load_binary(buffer.data(), image.size());
+		EXPECT_THROW(loaded.translate("list"), std::runtime_error);
+	}
+}
+
+TEST_F(translator_f, function_cache_works)
+{
+	context child{ &ctx };
+	child.set_user_var("kills", 1);
+
+	EXPECT_EQ("monster", child.interpolate("[ [.kills == 1] ? monster : monsters]"));
+	EXPECT_EQ(0, child.function_cache_stats().hits);
+	EXPECT_EQ(2, child.function_cache_stats().misses);
+	EXPECT_EQ("monster", child.interpolate("[ [.kills == 1] ? monster : monsters]"));
+	EXPECT_EQ(2, child.function_cache_stats().hits);
+	EXPECT_EQ(2, child.function_cache_stats().misses);
+
+	/// Binding a function in a parent context invalidates the cache
+	ctx.bind_function("arg ? arg : arg", [](context& e, std::vector<json> args) -> json { return "overridden"; });
+	EXPECT_EQ("overridden", child.interpolate("[ [.kills == 1] ? monster : monsters]"));
+	EXPECT_EQ(2, child.function_cache_stats().hits);
+	EXPECT_EQ(3, child.function_cache_stats().misses);
+
+	/// Different call shapes do not share cache entries
+	child.bind_function("hello", [](context& e, std::vector<json> args) -> json { return "no args"; });
+	child.bind_function("hello arg", [](context& e, std::vector<json> args) -> json { return "one arg"; });
+	EXPECT_EQ("no args", child.interpolate("[hello]"));
+	EXPECT_EQ("one arg", child.interpolate("[hello world]"));
+	EXPECT_EQ("no args", child.interpolate("[hello]"));
+
+	child.clear_function_cache();
+	EXPECT_EQ(0, child.function_cache_stats().hits);
+	EXPECT_EQ(0, child.function_cache_stats().misses);
+}
+
+TEST_F(translator_f, symbols_are_shared_with_child_contexts)
+{
+	context child{ &ctx };
+	EXPECT_EQ(&ctx.symbols(), &child.symbols());
+
+	const auto symbols_before = ctx.symbols().size();
+	child.set_user_var("kills", 5);
+	const auto kills = ctx.symbols().find("kills");
+	EXPECT_TRUE(kills);
+	EXPECT_EQ(ctx.symbols().intern("kills"), kills);
+	EXPECT_EQ(ctx.symbols().name(kills), "kills");
+	EXPECT_EQ(symbols_before + 1, ctx.symbols().size());
+
+	EXPECT_EQ(child.user_var(kills), 5);
+	EXPECT_EQ(child.find_variable("kills").first, &child);
+	EXPECT_EQ(ctx.find_variable("kills").first, nullptr);
+	EXPECT_EQ(child.find_variable("never-interned").first, nullptr);
+
+	/// Parameter names of functions bound in children are interned in the root
+	child.bind_function("frobnicate arg", [](context& e, std::vector<json> args) -> json { return "frobnicated"; });
+	EXPECT_TRUE(ctx.symbols().find("frobnicate"));
+	EXPECT_EQ(child.interpolate("[frobnicate .kills]"), "frobnicated");
+	EXPECT_THROW(child.interpolate("[never-interned .kills]"), std::runtime_error);
+}
+
+TEST_F(translator_f, variable_maps_work)
+{
+	context::variable_map vars;
+	EXPECT_TRUE(vars.empty());
+	EXPECT_EQ(vars.find(symbol{ 1 }), vars.end());
+
+	/// References to values stay valid while the table grows
+	json& first = vars[symbol{ 1 }];
+	first = "first";
+	for (uint32_t i = 2; i <= 100; ++i)
+		EXPECT_TRUE(vars.emplace(symbol{ i }, i).second);
+	EXPECT_FALSE(vars.emplace(symbol{ 1 }, 1).second);
+	EXPECT_EQ(vars.size(), 100);
+	EXPECT_EQ(first, "first");
+	EXPECT_EQ(&vars.find(symbol{ 1 })->second, &first);
+
+	for (uint32_t i = 2; i <= 100; i += 3)
+		EXPECT_EQ(vars.erase(symbol{ i }), 1);
+	EXPECT_EQ(vars.erase(symbol{ 2 }), 0);
+	size_t remaining = 0;
+	for (auto const& [name, value] : vars)
+	{
+		EXPECT_NE(name.id % 3, 2);
+		++remaining;
+	}
+	EXPECT_EQ(remaining, vars.size());
+	for (uint32_t i = 2; i <= 100; ++i)
+	{
+		if (i % 3 == 2)
+			EXPECT_EQ(vars.find(symbol{ i }), vars.end());
+		else
+			EXPECT_EQ(vars.find(symbol{ i })->second, i);
+	}
+
+	/// Slots of erased variables are reused
+	EXPECT_TRUE(vars.emplace(symbol{ 2 }, 2).second);
+	EXPECT_EQ(vars.find(symbol{ 2 })->second, 2);
+
+	vars.clear();
+	EXPECT_TRUE(vars.empty());
+	EXPECT_EQ(vars.begin(), vars.end());
+	EXPECT_EQ(vars.find(symbol{ 3 }), vars.end());
+
+	/// Variables output directly by compiled templates are appended in place, and still fall back to the unknown variable getter
+	context child{ &ctx };
+	child.unknown_var_value_getter() = [](context&, std::string_view name) -> json { return format("<{}>", name); };
+	child.set_user_var("kills", 5);
+	const auto compiled = child.compile(child.parse("[.kills] [.unknown] [ [.kills] == 5]"));
+	EXPECT_EQ(std::count_if(compiled.code.begin(), compiled.code.end(), [](auto const& instruction) { return instruction.op == compiled_template::opcode::append_var; }), 2);
+	EXPECT_EQ(child.interpolate_compiled(compiled), "5 <unknown> true");
+}
+
+TEST_F(translator_f, nested_contexts_see_parent_changes)
+{
+	/// Deeply nested contexts cache function and variable lookups in their parents; the caches have to notice changes
+	context locale{ &ctx }, screen{ &locale }, widget{ &screen };
+	ctx.set_user_var("name", "root");
+	ctx.bind_function("describe arg", [](context& e, std::vector<json> args) -> json { return "root:" + e.value_to_string(e.eval_arg_steal(args, 0)); });
+
+	EXPECT_EQ(widget.interpolate("[describe .name]"), "root:root");
+	const auto compiled = widget.compile(widget.parse("[describe .name]"));
+	EXPECT_EQ(widget.interpolate_compiled(compiled), "root:root");
+
+	/// Binding in a closer parent changes the resolution
+	screen.bind_function("describe arg", [](context& e, std::vector<json> args) -> json { return "screen"; });
+	EXPECT_EQ(widget.interpolate("[describe .name]"), "screen");
+	EXPECT_EQ(widget.interpolate_compiled(widget.compile(widget.parse("[describe .name]"))), "screen");
+	EXPECT_EQ(locale.interpolate("[describe .name]"), "root:root");
+
+	/// Values changed in place, variables added closer, and variables removed are all seen
+	EXPECT_EQ(widget.interpolate("[.name]"), "root");
+	ctx.set_user_var("name", "changed");
+	EXPECT_EQ(widget.interpolate("[.name]"), "changed");
+	locale.set_user_var("name", "locale", true);
+	EXPECT_EQ(widget.interpolate("[.name]"), "locale");
+	EXPECT_EQ(widget.find_variable("name").first, &locale);
+	locale.context_variables().erase(ctx.symbols().find("name"));
+	EXPECT_EQ(widget.interpolate("[.name]"), "changed");
+	EXPECT_EQ(widget.find_variable("name").first, &ctx);
+
+	EXPECT_EQ(widget.find_variable("unset").first, nullptr);
+	screen.set_user_var("unset", 1, true);
+	EXPECT_EQ(widget.find_variable("unset").first, &screen);
+}
+
+TEST_F(translator_f, unknown_variables_are_memoized_per_render)
+{
+	size_t lookups = 0;
+	ctx.unknown_var_value_getter() = [&](context&, std::string_view name) -> json { ++lookups; return format("<{}>", name); };
+	const auto source = "[.playerName] [.playerName] [ [.playerName] == [.playerName] ] [.other]";
+	const auto compiled = ctx.compile(ctx.parse(source));
+
+	/// Off by default
+	EXPECT_EQ(ctx.interpolate(source), "<playerName> <playerName> true <other>");
+	EXPECT_EQ(lookups, 5);
+
+	ctx.options.memoize_unknown_vars = true;
+	lookups = 0;
+	EXPECT_EQ(ctx.interpolate(source), "<playerName> <playerName> true <other>");
+	EXPECT_EQ(lookups, 2);
+	EXPECT_EQ(ctx.interpolate_parsed(ctx.parse(source)), "<playerName> <playerName> true <other>");
+	EXPECT_EQ(lookups, 4);
+	EXPECT_EQ(ctx.interpolate_compiled(compiled), "<playerName> <playerName> true <other>");
+	EXPECT_EQ(lookups, 6);
+
+	/// The memo is discarded after each render, and variables set in the meantime take precedence
+	ctx.set_user_var("playerName", "Bob");
+	EXPECT_EQ(ctx.interpolate(source), "Bob Bob true <other>");
+	EXPECT_EQ(lookups, 7);
+
+	/// Outside of a render, every lookup calls the getter
+	EXPECT_EQ(ctx.user_var("other"), "<other>");
+	EXPECT_EQ(ctx.user_var("other"), "<other>");
+	EXPECT_EQ(lookups, 9);
+}
+
+TEST_F(translator_f, unknown_variables_can_be_prefetched)
+{
+	ctx.set_user_var("kills", 2);
+	const auto source = "[.playerName] has [.kills] [ [.playerName] == [.playerName] ] [.other]. [.kills]";
+
+	std::vector<std::string> referenced;
+	for (auto const name : ctx.referenced_variables(ctx.parse(source)))
+		referenced.emplace_back(ctx.symbols().name(name));
+	std::sort(referenced.begin(), referenced.end());
+	EXPECT_EQ(referenced, (std::vector<std::string>{ "kills", "other", "playerName" }));
+	const auto compiled = ctx.compile(ctx.parse_value(source));
+	EXPECT_EQ(compiled.variables.size(), 3);
+
+	size_t lookups = 0;
+	std::vector<std::vector<std::string>> batches;
+	ctx.unknown_var_value_getter() = [&](context&, std::string_view name) -> json { ++lookups; return format("<{}>", name); };
+	ctx.unknown_vars_batch_getter() = [&](context&, std::vector<std::string_view> const& names, std::vector<json>& values) {
+		auto& batch = batches.emplace_back(names.begin(), names.end());
+		std::sort(batch.begin(), batch.end());
+		/// Leaves the other variables to the single getter
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			if (names[i] == "playerName")
+				values[i] = "Bob";
+		}
+	};
+
+	EXPECT_EQ(ctx.interpolate(source), "Bob has 2 true <other>. 2");
+	EXPECT_EQ(ctx.interpolate_parsed(ctx.parse(source)), "Bob has 2 true <other>. 2");
+	EXPECT_EQ(ctx.interpolate_compiled(compiled), "Bob has 2 true <other>. 2");
+	EXPECT_EQ(lookups, 3);
+	ASSERT_EQ(batches.size(), 3);
+	for (auto const& batch : batches)
+		EXPECT_EQ(batch, (std::vector<std::string>{ "other", "playerName" }));
+
+	/// Prefetched values are only kept for one render
+	EXPECT_EQ(ctx.user_var("playerName"), "<playerName>");
+
+	auto cctx = translator_new_context();
+	int c_batches = 0;
+	translator_set_unknown_vars_batch_getter(cctx, [](translator_context*, const char** names, int num_names, value* values, void* user_data) {
+		++*(int*)user_data;
+		for (int i = 0; i < num_names; ++i)
+			values[i] = translator_new_string_value(names[i]);
+	}, &c_batches);
+	auto result = translator_interpolate_str(cctx, "[.a] [.b] [.a]");
+	EXPECT_EQ(result, "a b a"sv);
+	free((void*)result);
+	EXPECT_EQ(c_batches, 1);
+	translator_delete_context(cctx);
+}
+
+TEST_F(translator_f, constant_calls_can_be_folded)
+{
+	int impure_calls = 0;
+	ctx.bind_function("count arg", [&](context& e, std::vector<json> args) -> json { ++impure_calls; return e.eval_arg_steal(args, 0); });
+	ctx.set_user_var("kills", true);
+	const auto source = "A[str 5]B [ [1 == 1] ? yes : no ] [cat x, [str 2] and z] [.kills == [1 == 1]] [count [str 1]]";
+	const auto expected = ctx.interpolate(source);
+	EXPECT_EQ(impure_calls, 1);
+
+	/// Arguments of functions that are not pure are left alone, as those functions may not evaluate them
+	auto parsed = ctx.parse(source);
+	EXPECT_EQ(ctx.fold_constants(parsed), 6);
+	ASSERT_EQ(parsed.size(), 4);
+	EXPECT_EQ(parsed[0], "A5B yes x2z ");
+	EXPECT_EQ(parsed[1], ctx.parse_call(".kills == true"));
+	EXPECT_EQ(ctx.interpolate_parsed(parsed), expected);
+	EXPECT_EQ(impure_calls, 2);
+
+	auto parsed_template = ctx.parse_template(source);
+	EXPECT_EQ(ctx.fold_constants(parsed_template), 6);
+	ASSERT_EQ(parsed_template.root().elements().size(), 4);
+	EXPECT_EQ(ctx.interpolate_compiled(ctx.compile(parsed_template.root())), expected);
+
+	/// The calls that are left keep their spans, as do the values that arguments were folded into
+	ctx.options.track_source_spans = true;
+	auto tracked = ctx.parse_template(source);
+	ctx.options.track_source_spans = false;
+	EXPECT_EQ(ctx.fold_constants(tracked), 6);
+	auto const& calls = tracked.root().elements();
+	ASSERT_EQ(calls.size(), 4);
+	const auto span_of = [&](tagged_value const& node) { const auto span = tracked.spans().find(node); return span ? std::optional<uint32_t>{ span->begin } : std::nullopt; };
+	const auto source_view = std::string_view{ source };
+	EXPECT_EQ(span_of(calls[1]), source_view.find("[.kills"));
+	EXPECT_EQ(span_of(calls[1].elements()[2]), source_view.rfind("[1 == 1]"));
+	EXPECT_EQ(span_of(calls[3]), source_view.find("[count"));
+	EXPECT_EQ(span_of(calls[3].elements()[1]), source_view.find("[str 1]"));
+	EXPECT_FALSE(span_of(calls[0]));
+
+	catalog messages{ ctx };
+	messages.add("folded", source);
+	messages.add("plain", "nothing [count 1] to fold");
+	EXPECT_EQ(messages.translate("folded"), expected);
+	EXPECT_EQ(messages.fold_constants(), 6);
+	EXPECT_EQ(messages.translate("folded"), expected);
+	EXPECT_EQ(messages.translate("plain"), "nothing 1 to fold");
+
+	/// Calls that report errors are evaluated (and report them) at render time
+	auto failing = ctx.parse("[1 is 2]");
+	EXPECT_EQ(ctx.fold_constants(failing), 0);
+	EXPECT_EQ(failing, ctx.parse("[1 is 2]"));
+	EXPECT_TRUE(ctx.call_stack().empty());
+}
+
+TEST_F(translator_f, core_operators_are_compiled_to_intrinsics)
+{
+	int counted = 0;
+	ctx.bind_function("count arg", [&](context& e, std::vector<json> args) -> json { ++counted; return e.eval_arg_steal(args, 0); });
+	ctx.set_user_var("kills", 3);
+	ctx.set_user_var("gender", "female");
+	const auto source = "[ [.kills == 1] ? monster : monsters ] [.kills > 2] [not [.kills < 2]] [.kills * 2.5] [.kills - 0.5] "
+		"[ [count false] and [count 1] ] [ [count 1] or [count 2] ] [.kills , x, [.kills != 3]] "
+		"[match .gender with [male his] with [female her] default their] [match .kills with [1 one] default many]";
+	const auto expected = ctx.interpolate(source);
+	EXPECT_EQ(expected, "monsters true true 7.5 2.5 false 1 3xfalse her many");
+	EXPECT_EQ(counted, 2);
+
+	const auto compiled = ctx.compile(ctx.parse(source));
+	EXPECT_TRUE(std::none_of(compiled.code.begin(), compiled.code.end(), [](auto const& instruction) {
+		return instruction.op == compiled_template::opcode::call && instruction.function->intrinsic != intrinsic_op::none;
+	}));
+	EXPECT_EQ(ctx.interpolate_compiled(compiled), expected);
+	/// Only the arguments that decide the result are evaluated
+	EXPECT_EQ(counted, 4);
+
+	/// Rebinding an operator in a child context overrides the intrinsic
+	context child{ &ctx };
+	child.bind_function("arg == arg", [](context&, std::vector<json>) -> json { return "overridden"; });
+	EXPECT_EQ(child.interpolate_compiled(child.compile(child.parse("[1 == 1] [2 > 1]"))), "overridden true");
+}
+
+TEST_F(translator_f, errors_can_be_values)
+{
+	ctx.options.errors_as_values = true;
+	ctx.unknown_func_handler() = {};
+	ctx.bind_simple_function("double arg", [](int x) { return x * 2; });
+	ctx.bind_function("upper arg", [](context& e, std::vector<json> args) -> json { return e.eval_arg_steal(args, 0, json::value_t::string); });
+
+	/// Errors propagate through functions and operators, are false in conditions, and are rendered as nothing
+	const auto source = "a[nope]b [double [nope]] [ [nope] == 1 ] [ [nope] ? yes : no ] [upper 5] [double 4] c";
+	const auto result = ctx.interpolate_with_errors(source);
+	EXPECT_EQ(result.output, "ab   no  8 c");
+	ASSERT_EQ(result.errors.size(), 5);
+	EXPECT_EQ(result.errors[0].message, "function for call '[nope]' not found");
+	EXPECT_FALSE(result.ok());
+	EXPECT_TRUE(ctx.errors().empty());
+
+	EXPECT_EQ(ctx.interpolate_compiled(ctx.compile(ctx.parse(source))), result.output);
+	EXPECT_EQ(ctx.errors().size(), 5);
+
+	/// Each render starts with no errors
+	EXPECT_EQ(ctx.interpolate("[double 1]"), "2");
+	EXPECT_TRUE(ctx.errors().empty());
+
+	/// Concatenation stops at the first error, compiled or not
+	int counted = 0;
+	ctx.bind_function("count arg", [&](context& e, std::vector<json> args) -> json { ++counted; return e.eval_arg_steal(args, 0); });
+	const auto cat_source = "[a , [nope] , [count 1]] [cat 1 , 2 and [count 3]]";
+	EXPECT_EQ(ctx.interpolate(cat_source), " 123");
+	EXPECT_EQ(ctx.errors().size(), 1);
+	EXPECT_EQ(counted, 1);
+	EXPECT_EQ(ctx.interpolate_compiled(ctx.compile(ctx.parse(cat_source))), " 123");
+	EXPECT_EQ(ctx.errors().size(), 1);
+	EXPECT_EQ(counted, 2);
+
+	ctx.options.errors_as_values = false;
+	EXPECT_THROW(ctx.interpolate("[upper 5]"), std::runtime_error);
+}
+
+TEST_F(translator_f, scopes_can_be_terminated_without_exceptions)
+{
+	ctx.bind_function("repeat arg times arg", [](context& e, std::vector<json> args) -> json {
+		const auto count = e.eval_arg_steal(args, 0).get<int64_t>();
+		std::string result;
+		for (int64_t i = 0; i < count; ++i)
+		{
+			e.set_user_var("i", i);
+			auto value = e.eval(args[1]);
+			if (e.pending_terminator() == context::scope_terminator::none)
+				result += e.value_to_string(value);
+			else if (e.end_loop_iteration())
+				break;
+		}
+		return result;
+	});
+	ctx.bind_function("break", [](context& e, std::vector<json>) -> json { e.terminate_scope(context::scope_terminator::break_loop); return nullptr; });
+	ctx.bind_function("continue", [](context& e, std::vector<json>) -> json { e.terminate_scope(context::scope_terminator::continue_loop); return nullptr; });
+	ctx.bind_function("return arg", [](context& e, std::vector<json> args) -> json { e.terminate_scope(context::scope_terminator::return_value, e.eval_arg_steal(args, 0)); return nullptr; });
+	ctx.bind_function("body arg", [](context& e, std::vector<json> args) -> json { return e.take_return_value(e.eval_arg_steal(args, 0)); });
+
+	EXPECT_EQ(ctx.interpolate("[repeat 5 times [ [.i == 3] ? [break] : [ [.i == 1] ? [continue] : .i ] ] ]"), "02");
+	/// Functions whose arguments are cut short return without checking them
+	EXPECT_EQ(ctx.interpolate("[repeat 3 times [.i is [break]]]"), "");
+	EXPECT_EQ(ctx.interpolate("[body [cat a, [return b] and c]] [body d]"), "b d");
+	EXPECT_EQ(ctx.interpolate_compiled(ctx.compile(ctx.parse("[repeat 4 times [ [.i == 2] ? [break] : .i ] ]"))), "01");
+
+	EXPECT_THROW(ctx.interpolate("[break]"), std::runtime_error);
+	EXPECT_THROW(ctx.interpolate_compiled(ctx.compile(ctx.parse("[ [1 == 1] ? [continue] : no ]"))), std::runtime_error);
+	EXPECT_THROW(ctx.interpolate("[return 5]"), std::runtime_error);
+	EXPECT_EQ(ctx.pending_terminator(), context::scope_terminator::none);
+	EXPECT_EQ(ctx.interpolate("[repeat 2 times .i]"), "01");
+}
+
+TEST_F(translator_f, call_stack_frames_are_described_on_demand)
+{
+	ctx.options.maintain_call_stack = true;
+	ctx.options.call_stack_store_call_string = true;
+	std::vector<std::string> descriptions;
+	ctx.bind_function("where arg", [&](context& e, std::vector<json> args) -> json {
+		for (auto const& frame : e.call_stack())
+			descriptions.push_back(e.describe_call(frame));
+		return nullptr;
+	});
+
+	const auto parsed = ctx.parse("[where .x]");
+	ctx.interpolate_parsed(parsed);
+	EXPECT_EQ(descriptions, std::vector<std::string>{ "[where .x]" });
+
+	/// Arguments evaluated by functions are handed over to them, so only their signatures are known
+	descriptions.clear();
+	const auto nested = ctx.parse("[str [where 1]]");
+	ctx.interpolate_parsed(nested);
+	EXPECT_EQ(descriptions, (std::vector<std::string>{ "[str [where 1]]", "[where arg]" }));
+
+	descriptions.clear();
+	ctx.interpolate_compiled(ctx.compile(ctx.parse("[ [where 2] ? a : b ]")));
+	EXPECT_EQ(descriptions, std::vector<std::string>{ "[where 2]" });
+	EXPECT_TRUE(ctx.call_stack().empty());
+}
+
+TEST_F(translator_f, throwing_calls_leave_no_frames_behind)
+{
+	ctx.options.maintain_call_stack = true;
+	ctx.options.call_stack_store_call_string = true;
+	ctx.bind_function("boom arg", [](context&, std::vector<json>) -> json { throw std::runtime_error("boom"); });
+
+	{
+		const auto compiled = ctx.compile(ctx.parse("xx [boom .v] yy"));
+		EXPECT_THROW(ctx.interpolate_compiled(compiled), std::runtime_error);
+		EXPECT_TRUE(ctx.call_stack().empty());
+	}
+	EXPECT_THROW(ctx.interpolate("[str [boom 1]]"), std::runtime_error);
+	EXPECT_TRUE(ctx.call_stack().empty());
+
+	/// Errors reported later are not blamed on the calls that threw
+	ctx.options.errors_as_values = true;
+	ctx.unknown_func_handler() = {};
+	ctx.interpolate("[nosuchfunction 1]");
+	ASSERT_EQ(ctx.errors().size(), 1);
+	EXPECT_EQ(ctx.errors()[0].message, "function for call '[nosuchfunction 1]' not found");
+	EXPECT_EQ(ctx.errors()[0].call, "");
+}
+
+TEST_F(translator_f, calls_and_atoms_have_source_spans)
+{
+	source_map spans;
+	const auto parsed = ctx.parse("Hi\n  [.a == 'x y']!", &spans);
+	ASSERT_EQ(parsed.size(), 3);
+	EXPECT_FALSE(spans.find(parsed[0]));
+
+	const auto call = spans.find(parsed[1]);
+	ASSERT_TRUE(call);
+	EXPECT_EQ(call->begin, 5);
+	EXPECT_EQ(call->end, 18);
+	EXPECT_EQ(call->line, 2);
+	EXPECT_EQ(call->column, 3);
+
+	const auto atom = spans.find(parsed[1][2]);
+	ASSERT_TRUE(atom);
+	EXPECT_EQ(atom->begin, 12);
+	EXPECT_EQ(atom->end, 17);
+	EXPECT_EQ(atom->column, 10);
+
+	/// Errors refer to the position of the call that reported them
+	ctx.options.maintain_call_stack = true;
+	ctx.bind_function("upper arg", [](context& e, std::vector<json> args) -> json { return e.eval_arg_steal(args, 0, json::value_t::string); });
+	const auto failing = ctx.parse("ok\n\n   [upper 5]", &spans);
+	try
+	{
+		ctx.interpolate_parsed(failing, spans);
+		ADD_FAILURE();
+	}
+	catch (std::runtime_error const& e)
+	{
+		EXPECT_TRUE(std::string_view{ e.what() }.substr(0, 5) == "3:4: ") << e.what();
+	}
+
+	ctx.options.errors_as_values = true;
+	ctx.options.track_source_spans = true;
+	const auto check_error = [&](uint32_t line, uint32_t column) {
+		ASSERT_EQ(ctx.errors().size(), 1);
+		ASSERT_TRUE(ctx.errors()[0].span);
+		EXPECT_EQ(ctx.errors()[0].span->line, line);
+		EXPECT_EQ(ctx.errors()[0].span->column, column);
+	};
+
+	ctx.interpolate("a\nbc [upper 5]");
+	check_error(2, 4);
+
+	/// Arguments evaluated by functions are handed over to them, so their errors refer to the innermost call with a known position
+	const auto tmpl = ctx.parse_template("[upper 'x']\n [upper [upper 5]]");
+	EXPECT_FALSE(tmpl.spans().empty());
+	ctx.interpolate_compiled(ctx.compile(tmpl));
+	check_error(2, 2);
+
+	const auto converted = ctx.parse("[upper 'x'][upper 5]", &spans);
+	ctx.interpolate_compiled(ctx.compile(converted, &spans));
+	check_error(1, 12);
+
+	int line = 0, column = 0;
+	EXPECT_TRUE(translator_error_position(&ctx, 0, &line, &column));
+	EXPECT_EQ(line, 1);
+	EXPECT_EQ(column, 12);
+}
+
+TEST_F(translator_f, function_calls_can_be_profiled)
+{
+	ctx.bind_simple_function("twice arg", [](int x) { return x * 2; });
+	ctx.bind_function("pair arg and arg", [](context& e, std::vector<json> args) -> json {
+		return e.eval_arg_steal(args, 0).dump() + e.eval_arg_steal(args, 1).dump();
+	});
+
+	EXPECT_EQ(ctx.interpolate("[twice 2]"), "4");
+	EXPECT_TRUE(ctx.function_profiles().empty());
+
+	ctx.options.profile_functions = true;
+	EXPECT_EQ(ctx.interpolate("[pair [twice [twice 2]] and [twice 1]]"), "82");
+	auto profiles = ctx.function_profiles();
+	ASSERT_EQ(profiles.size(), 2);
+	const auto find_profile = [&](std::string_view signature) {
+		const auto it = std::find_if(profiles.begin(), profiles.end(), [&](function_profile const& p) { return p.signature == signature; });
+		return it != profiles.end() ? *it : function_profile{};
+	};
+	EXPECT_EQ(find_profile("twice arg").calls, 3);
+	EXPECT_EQ(find_profile("twice arg").calls_by_arg_count[1], 3);
+	EXPECT_EQ(find_profile("pair arg and arg").calls_by_arg_count[2], 1);
+	/// `pair` evaluates its arguments, so the calls to `twice` are part of its inclusive time only
+	EXPECT_GE(find_profile("pair arg and arg").inclusive_time, find_profile("twice arg").inclusive_time);
+	EXPECT_LE(find_profile("pair arg and arg").exclusive_time, find_profile("pair arg and arg").inclusive_time);
+
+	/// Child contexts add their profiles to the root when they are destroyed
+	{
+		context child{ &ctx };
+		EXPECT_EQ(child.interpolate("[twice 5]"), "10");
+		EXPECT_EQ(child.function_profiles().size(), 1);
+	}
+	profiles = ctx.function_profiles();
+	EXPECT_EQ(find_profile("twice arg").calls, 4);
+
+	translator_function_profile c_profiles[4];
+	ASSERT_EQ(translator_function_profiles(&ctx, c_profiles, 4), 2);
+	EXPECT_EQ(c_profiles[0].calls + c_profiles[1].calls, 5);
+
+	ctx.reset_function_profiles();
+	EXPECT_TRUE(ctx.function_profiles().empty());
+}
+
+TEST_F(translator_f, template_renders_can_be_profiled)
+{
+	/// Latencies are recorded with a bounded relative error
+	for (const uint64_t ns : { 0ull, 7ull, 8ull, 100ull, 12345ull, 987654321ull })
+	{
+		const auto bucket = latency_histogram::bucket_of(ns);
+		EXPECT_GE(latency_histogram::bucket_upper_bound(bucket), ns);
+		EXPECT_LE(latency_histogram::bucket_upper_bound(bucket), ns + ns / latency_histogram::sub_buckets);
+	}
+	latency_histogram histogram;
+	for (int i = 1; i <= 100; ++i)
+		histogram.record(std::chrono::microseconds(i));
+	EXPECT_EQ(histogram.count(), 100);
+	EXPECT_EQ(histogram.max(), std::chrono::microseconds(100));
+	EXPECT_NEAR(double(histogram.percentile(0.5).count()), 50000.0, 50000.0 / latency_histogram::sub_buckets);
+
+	render_profiler profiler{ 3 };
+	ctx.set_render_profiler(&profiler);
+	ctx.bind_simple_function("twice arg", [](int x) { return x * 2; });
+
+	for (int i = 0; i < 3; ++i)
+		EXPECT_EQ(ctx.interpolate("a[twice 2]"), "a4");
+	EXPECT_EQ(ctx.interpolate("[twice 50]"), "100");
+	const auto parsed = ctx.parse("b[twice 3]");
+	EXPECT_EQ(ctx.interpolate_parsed(parsed), "b6");
+
+	catalog messages{ ctx };
+	messages.add("greeting", "Hello [twice 21]");
+	EXPECT_EQ(messages.translate("greeting"), "Hello 42");
+	EXPECT_EQ(messages.translate("greeting"), "Hello 42");
+
+	/// Child contexts use the profiler of their parent
+	{
+		context child{ &ctx };
+		EXPECT_EQ(child.interpolate("a[twice 2]"), "a4");
+	}
+
+	/// Templates beyond the limit are recorded together
+	ASSERT_EQ(profiler.template_count(), 4);
+	const auto hot = profiler.top(1, render_profiler::ranking::renders);
+	ASSERT_EQ(hot.size(), 1);
+	EXPECT_EQ(hot[0].name, "a[twice 2]");
+	EXPECT_EQ(hot[0].renders, 4);
+	EXPECT_EQ(hot[0].total_output_size, 8);
+	EXPECT_EQ(hot[0].latency.count(), 4);
+
+	const auto stats = profiler.snapshot();
+	const auto other = std::find_if(stats.begin(), stats.end(), [](template_stats const& t) { return t.name == render_profiler::other_templates_name; });
+	ASSERT_NE(other, stats.end());
+	EXPECT_EQ(other->renders, 2);
+	EXPECT_EQ(other->max_output_size, 8);
+
+	const auto report = profiler.report(2, render_profiler::ranking::renders);
+	EXPECT_NE(report.find("a[twice 2]"), std::string::npos);
+	EXPECT_EQ(std::count(report.begin(), report.end(), '\n'), 3);
+
+	/// Parsed templates are named by their json representation
+	const auto parsed_stats = std::find_if(stats.begin(), stats.end(), [&](template_stats const& t) { return t.name == parsed.dump(); });
+	ASSERT_NE(parsed_stats, stats.end());
+	EXPECT_EQ(parsed_stats->renders, 1);
+
+	profiler.reset();
+	ctx.set_render_profiler(nullptr);
+	ctx.interpolate("[twice 1]");
+	EXPECT_EQ(profiler.template_count(), 0);
+}
+
+TEST_F(translator_f, render_profiler_merges_renders_from_many_threads)
+{
+	render_profiler profiler;
+	ctx.set_render_profiler(&profiler);
+	ctx.bind_simple_function("twice arg", [](int x) { return x * 2; });
+	const auto parsed = ctx.parse("b[twice 3]");
+	batch_renderer renderer{ ctx, 4 };
+
+	std::vector<batch_job> jobs(200, batch_job{ "a[twice 2]" });
+	std::vector<std::string> results(jobs.size());
+	for (int i = 0; i < 2; ++i)
+		renderer.render(jobs.data(), jobs.size(), results.data());
+	context child{ &ctx };
+	EXPECT_EQ(child.interpolate_parsed(parsed), "b6");
+
+	const auto stats = profiler.top(2, render_profiler::ranking::renders);
+	ASSERT_EQ(stats.size(), 2);
+	EXPECT_EQ(stats[0].name, "a[twice 2]");
+	EXPECT_EQ(stats[0].renders, 400);
+	EXPECT_EQ(stats[0].latency.count(), 400);
+	EXPECT_EQ(stats[0].total_output_size, 800);
+	EXPECT_EQ(stats[1].name, parsed.dump());
+	EXPECT_EQ(stats[1].renders, 1);
+}
+
+TEST_F(translator_f, frozen_contexts_work)
+{
+	ctx.set_user_var("greeting", "Hello");
+	ctx.freeze();
+	EXPECT_TRUE(ctx.frozen());
+	EXPECT_TRUE(ctx.symbols().thread_safe());
+
+	EXPECT_THROW(ctx.bind_function("frobnicate", [](context& e, std::vector<json> args) -> json { return nullptr; }), std::runtime_error);
+	EXPECT_THROW(ctx.set_user_var("greeting", "Bye"), std::runtime_error);
+	EXPECT_THROW(ctx.interpolate("[.greeting == Hello]"), std::runtime_error);
+
+	/// Frozen contexts are shared between threads, so they do not record errors, even with `errors_as_values` set
+	ctx.options.errors_as_values = true;
+	EXPECT_THROW(ctx.set_user_var("greeting", "Bye"), std::runtime_error);
+	EXPECT_TRUE(ctx.errors().empty());
+
+	/// Each thread evaluates in its own child context, sharing the functions and variables of the frozen root
+	std::vector<std::string> results(8);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		threads.emplace_back([&, i] {
+			context child{ &ctx };
+			child.unknown_var_value_getter() = [](context&, std::string_view name) -> json { return std::string{ name }; };
+			EXPECT_THROW(ctx.set_user_var("greeting", "Bye"), std::runtime_error);
+			child.set_user_var("id", i);
+			/// Shadows the root variable
+			child.set_user_var("greeting", "Hi");
+			const auto compiled = child.compile(child.parse(format("[.greeting], [.id] [ [.id == 1] ? one : many] [.unknown{}]", i)));
+			for (int repeat = 0; repeat < 100; ++repeat)
+				results[i] = child.interpolate_compiled(compiled) + child.interpolate(" [.id + 1]");
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	for (size_t i = 0; i < results.size(); ++i)
+		EXPECT_EQ(results[i], format("Hi, {} {} unknown{} {}", i, i == 1 ? "one" : "many", i, i + 1));
+	EXPECT_EQ(ctx.user_var("greeting"), "Hello");
+}
+
+TEST_F(translator_f, batch_rendering_works)
+{
+	ctx.set_user_var("greeting", "Hello");
+	const auto compiled = ctx.compile(ctx.parse("[.greeting], [.name]! [ [.kills == 1] ? monster : monsters]"));
+
+	batch_renderer renderer{ ctx, 4, [](context& worker) {
+		worker.error_handler() = [](context const&, std::string_view err) -> std::string { throw std::runtime_error(std::string{ err }); };
+	} };
+	EXPECT_TRUE(ctx.frozen());
+	EXPECT_EQ(renderer.worker_count(), 4);
+
+	std::vector<json> variables;
+	for (size_t i = 0; i < 1000; ++i)
+		variables.push_back(json{ { "name", format("player{}", i) }, { "kills", i % 3 } });
+
+	std::vector<batch_job> jobs;
+	for (size_t i = 0; i < variables.size(); ++i)
+	{
+		if (i % 2)
+			jobs.push_back({ {}, &compiled, &variables[i] });
+		else
+			jobs.push_back({ "[.name] has [.kills] kills", nullptr, &variables[i] });
+	}
+	jobs.push_back({ "[nonexistent-function]" });
+
+	std::vector<std::string> results(jobs.size());
+	const auto stats = renderer.render(jobs.data(), jobs.size(), results.data());
+	EXPECT_EQ(stats.jobs, jobs.size());
+	EXPECT_EQ(stats.failed_jobs, 1);
+	EXPECT_GT(stats.jobs_per_second(), 0);
+	ASSERT_EQ(stats.workers.size(), 4);
+	size_t jobs_done = 0;
+	for (auto const& worker : stats.workers)
+	{
+		jobs_done += worker.jobs;
+		EXPECT_GE(worker.utilization, 0);
+		EXPECT_LE(worker.utilization, 1);
+	}
+	EXPECT_EQ(jobs_done, jobs.size());
+
+	for (size_t i = 0; i < variables.size(); ++i)
+	{
+		if (i % 2)
+			EXPECT_EQ(results[i], format("Hello, player{}! {}", i, i % 3 == 1 ? "monster" : "monsters"));
+		else
+			EXPECT_EQ(results[i], format("player{} has {} kills", i, i % 3));
+	}
+	EXPECT_NE(results.back().find("nonexistent-function"), std::string::npos);
+
+	/// Variables of a job do not leak into the next ones
+	EXPECT_EQ(renderer.render({ { "[.name]" } }), std::vector<std::string>{ "<null>" });
+}
+
+TEST_F(translator_f, batch_renderer_counts_errors_recorded_as_values)
+{
+	ctx.unknown_func_handler() = {};
+	ctx.bind_function("boom arg", [](context&, std::vector<json>) -> json { throw std::runtime_error("boom"); });
+	const auto compiled = ctx.compile(ctx.parse("xx [boom .v] yy"));
+	batch_renderer renderer{ ctx, 2, [](context& worker) {
+		worker.options.errors_as_values = true;
+		worker.options.maintain_call_stack = true;
+		worker.options.call_stack_store_call_string = true;
+	} };
+
+	/// Jobs that throw leave nothing behind for the jobs after them on the same worker
+	std::vector<batch_job> jobs;
+	for (size_t i = 0; i < 50; ++i)
+	{
+		jobs.push_back({ "a[nope]b" });
+		jobs.push_back({ "ok" });
+		jobs.push_back({ {}, &compiled });
+		jobs.push_back({ "[nope] [str [boom 1]]" });
+		jobs.push_back({ "[nope] [nope]" });
+	}
+	std::vector<std::string> results(jobs.size());
+	const auto stats = renderer.render(jobs.data(), jobs.size(), results.data());
+	EXPECT_EQ(stats.failed_jobs, 200);
+	for (size_t i = 0; i < jobs.size(); i += 5)
+	{
+		EXPECT_EQ(results[i], "function for call '[nope]' not found");
+		EXPECT_EQ(results[i + 1], "ok");
+		EXPECT_EQ(results[i + 2], "boom");
+		EXPECT_EQ(results[i + 3], "boom");
+		EXPECT_EQ(results[i + 4], "function for call '[nope]' not found\nfunction for call '[nope]' not found");
+	}
+}
+
 TEST_F(translator_f, unnamed_test_1)
 {
 	ctx.set_user_var("kills", 25);
@@ -279,9 +1161,10 @@ TEST_F(translator_f, unnamed_test_1)
 
 TEST_F(translator_f, can_bind_different_functions_with_same_prefix)
 {
-	auto a = ctx.bind_function("a arg", if_then_else);
-	auto b = ctx.bind_function("a arg b arg", if_then_else);
-	auto c = ctx.bind_function("a arg b arg c arg", if_then_else);
+	const auto func = [](context&, std::vector<json>) -> json { return nullptr; };
+	auto a = ctx.bind_function("a arg", func);
+	auto b = ctx.bind_function("a arg b arg", func);
+	auto c = ctx.bind_function("a arg b arg c arg", func);
 	EXPECT_NE(a, b);
 	EXPECT_NE(b, c);
 	EXPECT_NE(a, c);
@@ -441,7 +1324,7 @@ TEST_F(translator_f, variadic_functions_are_sanely_defined)
 	ctx.bind_function("arg : arg : arg", [&](context& e, std::vector<json> args)->json { return nullptr; });
 	EXPECT_THROW(ctx.interpolate("[a : b : c]"), std::runtime_error);
 
-	ctx.bind_function("list arg , arg*", list);
+	ctx.bind_function("list arg , arg*", [&](context& e, std::vector<json> args)->json { return nullptr; });
 	EXPECT_THROW(ctx.interpolate("[list a, b, c or d]"), std::runtime_error);
 
 	ctx.bind_function("find text or file?", [&](context& e, std::vector<json> args)->json { return nullptr; });
@@ -477,10 +1360,80 @@ TEST_F(translator_f, single_optional_should_work)
 	EXPECT_THROW(ctx.interpolate("[hullo]"), std::runtime_error);
 }
 
+TEST_F(translator_f, span_functions_work)
+{
+	ctx.bind_function("arg minus arg", [](context& e, argument_span args) -> json {
+		if (args.size() != 2)
+			return e.report_error("minus needs 2 arguments");
+		return e.eval(std::move(args[0])).get<int>() - e.eval(std::move(args[1])).get<int>();
+	});
+	/// Captures too big to be stored inline are allocated once, when bound
+	std::array<int, 16> big_capture{};
+	big_capture[15] = 7;
+	ctx.bind_function("count arg ; arg*", [big_capture](context& e, argument_span args) -> json {
+		for (auto& arg : args)
+			arg = e.eval(std::move(arg));
+		return json{ args.size(), big_capture[15] };
+	});
+
+	ctx.set_user_var("kills", 5);
+	EXPECT_EQ(ctx.interpolate("[.kills minus 2] [ [10 minus 3] minus [.kills minus 4]]"), "3 6");
+	const auto compiled = ctx.compile(ctx.parse("[.kills minus 2] [count 1 ; 2 ; 3] [count 1 ; 2 ; 3 ; 4 ; 5 ; 6 ; 7 ; 8 ; 9 ; 10]"));
+	EXPECT_EQ(ctx.interpolate_compiled(compiled), "3 [3 7] [10 7]");
+	EXPECT_EQ(ctx.interpolate("[count 1 ; 2]"), "[2 7]");
+
+	native_eval_func small = [counter = 40](context&, argument_span args) mutable -> json { return ++counter + int(args.size()); };
+	native_eval_func copy = small;
+	native_eval_func moved = std::move(small);
+	EXPECT_FALSE(small);
+	EXPECT_EQ(copy(ctx, {}), 41);
+	EXPECT_EQ(copy(ctx, {}), 42);
+	EXPECT_EQ(moved(ctx, {}), 41);
+	native_eval_func big = [big_capture, name = std::string{ "a string that does not fit inline" }](context&, argument_span) -> json { return name; };
+	native_eval_func big_copy = big;
+	big = nullptr;
+	EXPECT_EQ(big_copy(ctx, {}), "a string that does not fit inline");
+
+	auto cctx = translator_new_context();
+	translator_bind_function(cctx, "twice arg", [](translator_context*, value_ref* args, int num_args, void*) -> value {
+		return translator_new_integer_value(num_args == 1 ? translator_value_get_integer(args[0]) * 2 : -1);
+	}, nullptr);
+	auto result = translator_interpolate_str(cctx, "[twice 21]");
+	EXPECT_EQ(result, "42"sv);
+	free((void*)result);
+	translator_delete_context(cctx);
+}
+
+static double halve(double value) { return value / 2; }
+
 TEST_F(translator_f, simple_bindings_work)
 {
-	//ctx.bind_simple_function("arg + arg", [](int a, int b) { return a + b; });
-	//EXPECT_EQ(ctx.interpolate("[hello]"), "world");
+	ctx.bind_simple_function("arg plus arg", [](int a, int b) { return a + b; }, function_flag::pure);
+	ctx.bind_simple_function("half arg", halve);
+	ctx.bind_simple_function("upper arg", [](std::string str) { for (auto& c : str) c = char(toupper(c)); return str; });
+	ctx.bind_simple_function("greet arg", [](context& e, std::string_view name) { return "Hello, " + std::string{ name } + e.value_to_string("!"); });
+	ctx.bind_simple_function("hello", [] { return "world"; });
+	ctx.bind_simple_function("maybe arg?", [](bool value) { return !value; });
+	std::vector<json> logged;
+	ctx.bind_simple_function("log arg", [&](json value) { logged.push_back(std::move(value)); });
+
+	ctx.set_user_var("kills", 2);
+	ctx.set_user_var("name", "Bob");
+	EXPECT_EQ(ctx.interpolate("[hello] [3 plus 4] [.kills plus [.kills plus 1]] [half 3] [upper abc] [greet .name] [log [1 , 2]] [maybe false]"),
+		"world 7 5 1.5 ABC Hello, Bob! <null> true");
+	EXPECT_EQ(logged, std::vector<json>{ "12" });
+
+	const auto compiled = ctx.compile(ctx.parse("[.kills plus 1] [upper [greet .name]]"));
+	EXPECT_EQ(ctx.interpolate_compiled(compiled), "3 HELLO, BOB!");
+
+	/// Arguments are checked after they are evaluated
+	EXPECT_THROW(ctx.interpolate("[upper .kills]"), std::runtime_error);
+	EXPECT_THROW(ctx.interpolate("[maybe]"), std::runtime_error);
+
+	/// Simple functions can be folded like any other
+	auto parsed = ctx.parse("[1 plus 2]");
+	EXPECT_EQ(ctx.fold_constants(parsed), 1);
+	EXPECT_EQ(parsed, json::array({ "3" }));
 }
 
 int main(int argc, char** argv)
@@ -0,0 +1,310 @@
+#include "../include/ghassanpl/translator/render_profiler.hpp"
+#include "format.h"
+#include <algorithm>
+#include <cmath>
+
+namespace translator
+{
+	size_t latency_histogram::bucket_of(uint64_t nanoseconds) noexcept
+	{
+		if (nanoseconds < sub_buckets)
+			return size_t(nanoseconds);
+
+		nanoseconds = std::min(nanoseconds, (uint64_t(2) << max_exponent) - 1);
+		unsigned exponent = 0;
+		while (nanoseconds >> (exponent + 1))
+			++exponent;
+		/// The `sub_bucket_bits` bits below the highest set bit pick the linear bucket within the power of 2
+		const auto shift = exponent - sub_bucket_bits;
+		return size_t((shift + 1) * sub_buckets + ((nanoseconds >> shift) - sub_buckets));
+	}
+
+	uint64_t latency_histogram::bucket_upper_bound(size_t bucket) noexcept
+	{
+		if (bucket < sub_buckets)
+			return bucket;
+		const auto shift = unsigned(bucket / sub_buckets - 1);
+		const auto mantissa = bucket % sub_buckets + sub_buckets;
+		return ((mantissa + 1) << shift) - 1;
+	}
+
+	void latency_histogram::record(std::chrono::nanoseconds latency) noexcept
+	{
+		const auto value = uint64_t(std::max(latency.count(), std::chrono::nanoseconds::rep{}));
+		++m_counts[bucket_of(value)];
+		m_min = m_count ? std::min(m_min, value) : value;
+		m_max = std::max(m_max, value);
+		++m_count;
+	}
+
+	void latency_histogram::merge(latency_histogram const& other) noexcept
+	{
+		if (!other.m_count)
+			return;
+		for (size_t i = 0; i < bucket_count; ++i)
+			m_counts[i] += other.m_counts[i];
+		m_min = m_count ? std::min(m_min, other.m_min) : other.m_min;
+		m_max = std::max(m_max, other.m_max);
+		m_count += other.m_count;
+	}
+
+	std::chrono::nanoseconds latency_histogram::percentile(double fraction) const noexcept
+	{
+		if (!m_count)
+			return {};
+
+		const auto rank = std::max(uint64_t(std::ceil(std::clamp(fraction, 0.0, 1.0) * double(m_count))), uint64_t(1));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_count; ++i)
+		{
+			seen += m_counts[i];
+			if (seen >= rank)
+				return std::chrono::nanoseconds(std::min(bucket_upper_bound(i), m_max));
+		}
+		return max();
+	}
+
+	void template_stats::record(std::chrono::nanoseconds latency, size_t output_size) noexcept
+	{
+		min_output_size = renders ? std::min(min_output_size, output_size) : output_size;
+		max_output_size = std::max(max_output_size, output_size);
+		total_output_size += output_size;
+		total_time += latency;
+		this->latency.record(latency);
+		++renders;
+	}
+
+	void template_stats::merge(template_stats const& other) noexcept
+	{
+		if (!other.renders)
+			return;
+		min_output_size = renders ? std::min(min_output_size, other.min_output_size) : other.min_output_size;
+		max_output_size = std::max(max_output_size, other.max_output_size);
+		total_output_size += other.total_output_size;
+		total_time += other.total_time;
+		latency.merge(other.latency);
+		renders += other.renders;
+	}
+
+	namespace
+	{
+		/// The stats each thread records into, one for each profiler it has used
+		struct thread_stats_cache
+		{
+			struct entry
+			{
+				uint64_t profiler_id = 0;
+				std::shared_ptr<detail::thread_template_stats> stats;
+			};
+			std::vector<entry> entries;
+
+			~thread_stats_cache()
+			{
+				for (auto& entry : entries)
+					entry.stats->in_use.store(false, std::memory_order_release);
+			}
+		};
+		thread_local thread_stats_cache t_thread_stats;
+
+		std::atomic<uint64_t> g_next_profiler_id{ 1 };
+	}
+
+	render_profiler::render_profiler(size_t max_templates) noexcept
+		: m_id(g_next_profiler_id.fetch_add(1, std::memory_order_relaxed))
+		, m_max_templates(max_templates)
+	{
+	}
+
+	render_profiler::~render_profiler()
+	{
+		for (auto& stats : m_threads)
+			stats->orphaned.store(true, std::memory_order_release);
+	}
+
+	detail::thread_template_stats& render_profiler::local_stats()
+	{
+		auto& entries = t_thread_stats.entries;
+		for (auto const& entry : entries)
+		{
+			if (entry.profiler_id == m_id)
+				return *entry.stats;
+		}
+
+		entries.erase(std::remove_if(entries.begin(), entries.end(), [](auto const& entry) { return entry.stats->orphaned.load(std::memory_order_acquire); }), entries.end());
+
+		std::shared_ptr<detail::thread_template_stats> stats;
+		{
+			std::lock_guard lock{ m_threads_mutex };
+			/// Take over the stats of a thread that has exited, so that threads started for each batch of renders do not add up
+			for (auto const& existing : m_threads)
+			{
+				if (!existing->in_use.load(std::memory_order_acquire))
+				{
+					existing->in_use.store(true, std::memory_order_relaxed);
+					stats = existing;
+					break;
+				}
+			}
+			if (!stats)
+				stats = m_threads.emplace_back(std::make_shared<detail::thread_template_stats>());
+		}
+		return *entries.emplace_back(thread_stats_cache::entry{ m_id, std::move(stats) }).stats;
+	}
+
+	template_stats& render_profiler::other_templates(detail::thread_template_stats& stats)
+	{
+		auto it = stats.by_name.find(other_templates_name);
+		if (it == stats.by_name.end())
+		{
+			it = stats.by_name.try_emplace(std::string{ other_templates_name }).first;
+			it->second.name = other_templates_name;
+		}
+		return it->second;
+	}
+
+	void render_profiler::record(std::string_view name, std::chrono::nanoseconds latency, size_t output_size)
+	{
+		auto& stats = local_stats();
+		std::lock_guard lock{ stats.mutex };
+
+		auto it = stats.by_name.find(name);
+		if (it != stats.by_name.end())
+			return it->second.record(latency, output_size);
+		if (stats.template_count() >= m_max_templates)
+			return other_templates(stats).record(latency, output_size);
+
+		it = stats.by_name.try_emplace(std::string{ name }).first;
+		it->second.name = name;
+		it->second.record(latency, output_size);
+	}
+
+	bool render_profiler::knows(size_t hash)
+	{
+		auto& stats = local_stats();
+		std::lock_guard lock{ stats.mutex };
+		return stats.by_hash.count(hash) != 0;
+	}
+
+	void render_profiler::record(size_t hash, std::string name, std::chrono::nanoseconds latency, size_t output_size)
+	{
+		auto& stats = local_stats();
+		std::lock_guard lock{ stats.mutex };
+
+		auto it = stats.by_hash.find(hash);
+		if (it != stats.by_hash.end())
+			return it->second.record(latency, output_size);
+		/// An empty name means the template was known when the render started, but the stats were reset since
+		if (name.empty() || stats.template_count() >= m_max_templates)
+			return other_templates(stats).record(latency, output_size);
+
+		it = stats.by_hash.try_emplace(hash).first;
+		it->second.name = std::move(name);
+		it->second.record(latency, output_size);
+	}
+
+	std::vector<template_stats> render_profiler::snapshot() const
+	{
+		/// Different threads (or hashes) can record the same template
+		std::map<std::string, template_stats, std::less<>> merged;
+		{
+			std::lock_guard lock{ m_threads_mutex };
+			for (auto const& stats : m_threads)
+			{
+				std::lock_guard stats_lock{ stats->mutex };
+				const auto merge = [&](template_stats const& template_stats) {
+					const auto [it, inserted] = merged.try_emplace(template_stats.name);
+					if (inserted)
+						it->second.name = template_stats.name;
+					it->second.merge(template_stats);
+				};
+				for (auto const& [name, template_stats] : stats->by_name)
+					merge(template_stats);
+				for (auto const& [hash, template_stats] : stats->by_hash)
+					merge(template_stats);
+			}
+		}
+
+		std::vector<template_stats> result;
+		result.reserve(merged.size());
+		for (auto& [name, stats] : merged)
+			result.push_back(std::move(stats));
+		return result;
+	}
+
+	std::vector<template_stats> render_profiler::top(size_t count, ranking by) const
+	{
+		auto result = snapshot();
+		const auto key = [by](template_stats const& stats) -> double {
+			switch (by)
+			{
+			case ranking::renders: return double(stats.renders);
+			case ranking::p99_latency: return double(stats.latency.percentile(0.99).count());
+			case ranking::mean_output_size: return stats.mean_output_size();
+			case ranking::total_time: break;
+			}
+			return double(stats.total_time.count());
+		};
+
+		count = std::min(count, result.size());
+		std::partial_sort(result.begin(), result.begin() + count, result.end(), [&](template_stats const& a, template_stats const& b) {
+			const auto key_a = key(a), key_b = key(b);
+			return key_a != key_b ? key_a > key_b : a.name < b.name;
+		});
+		result.resize(count);
+		return result;
+	}
+
+	/// Template sources can be long and span many lines, so only the start of their first line is shown
+	static std::string report_name(std::string_view name)
+	{
+		static constexpr size_t max_length = 40;
+		auto result = std::string{ name.substr(0, std::min(name.find('\n'), max_length)) };
+		if (result.size() < name.size())
+			result += "...";
+		return result;
+	}
+
+	static std::string format_duration(std::chrono::nanoseconds duration)
+	{
+		const auto ns = double(duration.count());
+		if (ns >= 1e9) return format("{:.2f}s", ns / 1e9);
+		if (ns >= 1e6) return format("{:.2f}ms", ns / 1e6);
+		if (ns >= 1e3) return format("{:.2f}us", ns / 1e3);
+		return format("{}ns", duration.count());
+	}
+
+	std::string render_profiler::report(size_t count, ranking by) const
+	{
+		std::string result = format("{:<43} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>12}\n",
+			"template", "renders", "total", "mean", "p50", "p99", "max", "mean output");
+		for (auto const& stats : top(count, by))
+		{
+			result += format("{:<43} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>12.1f}\n",
+				report_name(stats.name),
+				stats.renders,
+				format_duration(stats.total_time),
+				format_duration(stats.mean_latency()),
+				format_duration(stats.latency.percentile(0.5)),
+				format_duration(stats.latency.percentile(0.99)),
+				format_duration(stats.latency.max()),
+				stats.mean_output_size());
+		}
+		return result;
+	}
+
+	size_t render_profiler::template_count() const
+	{
+		return snapshot().size();
+	}
+
+	void render_profiler::reset()
+	{
+		std::lock_guard lock{ m_threads_mutex };
+		for (auto const& stats : m_threads)
+		{
+			std::lock_guard stats_lock{ stats->mutex };
+			stats->by_name.clear();
+			stats->by_hash.clear();
+		}
+	}
+}
@@ -1,4 +1,5 @@
 #include "../include/ghassanpl/translator/translator.hpp"
+#include "../include/ghassanpl/translator/render_profiler.hpp"
 #include "format.h"
 #include <string.h>
 #include <charconv>
@@ -75,13 +76,57 @@ namespace translator
 		}
 	}
 
+	void context::default_json_value_append_func(context const& c, json const& j, output_sink& sink)
+	{
+		switch (j.type())
+		{
+		case json::value_t::string: sink.append(j.get_ref<json::string_t const&>()); break;
+		case json::value_t::binary: sink.append("<binary>"); break;
+		case json::value_t::null: sink.append("<null>"); break;
+		case json::value_t::boolean: sink.append(j.get<bool>() ? "true" : "false"); break;
+		case json::value_t::number_integer:
+		case json::value_t::number_unsigned:
+		{
+			char buffer[24];
+			const auto result = j.is_number_integer()
+				? std::to_chars(std::begin(buffer), std::end(buffer), j.get<json::number_integer_t>())
+				: std::to_chars(std::begin(buffer), std::end(buffer), j.get<json::number_unsigned_t>());
+			sink.append(std::string_view{ buffer, size_t(result.ptr - buffer) });
+			break;
+		}
+		case json::value_t::array:
+		{
+			sink.append(c.options.opening_delimiter);
+			bool first = true;
+			for (auto const& element : j)
+			{
+				if (!std::exchange(first, false))
+					sink.append(' ');
+				c.append_value(sink, element);
+			}
+			sink.append(c.options.closing_delimiter);
+			break;
+		}
+		default: sink.append(j.dump()); break;
+		}
+	}
+
 	context::context(context* parent) noexcept
 		: m_json_value_to_str_func(&default_json_value_to_str_func)
 	{
 		parent_context = (translator_context*)parent;
 		user_data = nullptr;
 		if (parent)
+		{
 			options = parent->options;
+			m_root = parent->m_root;
+			/// Frozen contexts never change, and can be shared by threads that create children at the same time
+			if (!parent->m_frozen && !parent->m_has_children)
+			{
+				parent->m_has_children = true;
+				parent->m_context_variables.share_generation(&m_root->m_variable_epoch);
+			}
+		}
 	}
 
 	context::context() noexcept
@@ -90,6 +135,11 @@ namespace translator
 		translator_init_context_options(this);
 	}
 
+	context::~context()
+	{
+		flush_function_profiles();
+	}
+
 	std::string context::consume_c_string(std::string_view& strv) const
 	{
 		std::string result;
@@ -127,7 +177,9 @@ namespace translator
 			}
 			else
 			{
+				/// Append the whole run of characters up to the next escape sequence (or the end of the string) at once
 				result += cp;
+				result += consume_until(view, [delimiter](char ch) { return ch == delimiter || ch == '\\'; });
 			}
 
 			if (view.empty())
@@ -145,6 +197,74 @@ namespace translator
 		return result;
 	}
 
+	/// If the C string at the start of `strv` has no escape sequences, consumes it and returns a view of its contents
+	static std::optional<std::string_view> consume_c_string_view(std::string_view& strv)
+	{
+		if (strv.empty())
+			return std::nullopt;
+
+		const char stops[] = { strv[0], '\\' };
+		const auto end = strv.find_first_of(std::string_view{ stops, 2 }, 1);
+		if (end == std::string_view::npos || strv[end] != strv[0])
+			return std::nullopt;
+
+		const auto result = strv.substr(1, end - 1);
+		strv.remove_prefix(end + 1);
+		return result;
+	}
+
+	/// A string read from a template, copied into `arena` or referring to the template (if `view_source` is set)
+	static tagged_value read_text(std::string_view str, std::pmr::memory_resource* arena, bool view_source)
+	{
+		return view_source ? tagged_value::make_view(str) : tagged_value{ str, arena };
+	}
+
+	/// Interprets `atom` as a `true`/`false`/`null` or number literal; returns an empty optional if it is neither
+	/// (i.e. it's a word). `RESULT` can be `json` or `tagged_value`.
+	template <typename RESULT>
+	static std::optional<RESULT> literal_atom(std::string_view atom, char hex_prefix)
+	{
+		/// TODO: We could have just a map from atom to `value` in `options`
+		if (atom == "true") return RESULT(true);
+		if (atom == "false") return RESULT(false);
+		if (atom == "null") return RESULT(nullptr);
+
+		const auto atom_end = atom.data() + atom.size();
+
+		if (hex_prefix && starts_with(atom, hex_prefix))
+		{
+			const auto hex_data = atom.substr(1);
+			json::number_unsigned_t num_result{};
+			const auto fcres = std::from_chars(hex_data.data(), hex_data.data() + hex_data.size(), num_result, 16);
+			if (fcres.ec == std::errc{} && fcres.ptr == atom_end) /// If we ate the ENTIRE number
+				return RESULT(num_result);
+		}
+
+		/// Try paring as number
+		{
+			json::number_integer_t num_result{};
+			const auto fcres = std::from_chars(atom.data(), atom_end, num_result);
+			if (fcres.ec == std::errc{} && fcres.ptr == atom_end) /// If we ate the ENTIRE number
+				return RESULT(num_result);
+		}
+
+		{
+			json::number_unsigned_t num_result{};
+			const auto fcres = std::from_chars(atom.data(), atom_end, num_result);
+			if (fcres.ec == std::errc{} && fcres.ptr == atom_end) /// If we ate the ENTIRE number
+				return RESULT(num_result);
+		}
+
+		{
+			json::number_float_t num_result{};
+			const auto fcres = std::from_chars(atom.data(), atom_end, num_result);
+			if (fcres.ec == std::errc{} && fcres.ptr == atom_end) /// If we ate the ENTIRE number
+				return RESULT(num_result);
+		}
+
+		return std::nullopt;
+	}
+
 	auto context::consume_atom(std::string_view& sexp_str) const -> nlohmann::json
 	{
 		trim_whitespace_left(sexp_str);
@@ -164,104 +284,248 @@ namespace translator
 				ch == ',';
 			});
 
-		/// TODO: We could have just a map from atom to `value` in `options`
-		if (result == "true") return true;
-		if (result == "false") return false;
-		if (result == "null") return nullptr;
+		if (auto literal = literal_atom<json>(result, options.hex_prefix))
+			return std::move(*literal);
 
-		if (options.hex_prefix && starts_with(result, options.hex_prefix))
-		{
-			const auto hex_data = result.substr(1);
-			json::number_unsigned_t num_result{};
-			const auto fcres = std::from_chars(hex_data.data(), hex_data.data() + hex_data.size(), num_result, 16);
-			if (fcres.ec == std::errc{} && fcres.ptr == sexp_str.data()) /// If we ate the ENTIRE number
-				return num_result;
-		}
+		return result;
+	}
 
-		/// Try paring as number
+	auto context::consume_list(std::string_view& sexp_str, bool require_closing_delim, detail::span_recorder* spans) const -> nlohmann::json
+	{
+		nlohmann::json result = nlohmann::json::array();
+		trim_whitespace_left(sexp_str);
+		while (!sexp_str.empty() && !starts_with(sexp_str, options.closing_delimiter))
 		{
-			nlohmann::json::number_integer_t num_result{};
-			const auto fcres = std::from_chars(result.data(), result.data() + result.size(), num_result);
-			if (fcres.ec == std::errc{} && fcres.ptr == sexp_str.data()) /// If we ate the ENTIRE number
-				return num_result;
+			result.push_back(consume_value(sexp_str, spans));
+			trim_whitespace_left(sexp_str);
 		}
+		auto closing = consume(sexp_str, options.closing_delimiter);
+		if (require_closing_delim && options.strict_syntax && !closing)
+			return report_error("list must end with closing delimiter");
+		return result;
+	}
 
+	auto context::consume_value(std::string_view& sexp_str, detail::span_recorder* spans) const -> nlohmann::json
+	{
+		trim_whitespace_left(sexp_str);
+		if (!spans)
 		{
-			nlohmann::json::number_unsigned_t num_result{};
-			const auto fcres = std::from_chars(result.data(), result.data() + result.size(), num_result);
-			if (fcres.ec == std::errc{} && fcres.ptr == sexp_str.data()) /// If we ate the ENTIRE number
-				return num_result;
+			if (consume(sexp_str, options.opening_delimiter))
+				return consume_list(sexp_str);
+			return consume_atom(sexp_str);
 		}
 
+		const auto span = spans->begin(sexp_str.data());
+		auto result = consume(sexp_str, options.opening_delimiter) ? consume_list(sexp_str, true, spans) : consume_atom(sexp_str);
+		spans->end(span, sexp_str.data());
+		if (!result.is_array())
+			spans->drop_children(span);
+		return result;
+	}
+
+	tagged_value context::read_atom(std::string_view& sexp_str, std::pmr::memory_resource* arena, bool view_source) const
+	{
+		trim_whitespace_left(sexp_str);
+
+		if (starts_with(sexp_str, '\'') || starts_with(sexp_str, '"'))
 		{
-			nlohmann::json::number_float_t num_result{};
-			const auto fcres = std::from_chars(result.data(), result.data() + result.size(), num_result);
-			if (fcres.ec == std::errc{} && fcres.ptr == sexp_str.data()) /// If we ate the ENTIRE number
-				return num_result;
+			/// Only strings with escape sequences need to be rewritten
+			if (const auto view = consume_c_string_view(sexp_str))
+				return read_text(*view, arena, view_source);
+			return { consume_c_string(sexp_str), arena };
 		}
 
-		return result;
+		if (consume(sexp_str, ','))
+			return tagged_value::make_word(symbols().intern(","));
+
+		const std::string_view result = consume_until(sexp_str, [this](auto ch) {
+			return translator::isspace(ch) ||
+				ch == options.closing_delimiter ||
+				ch == ',';
+			});
+
+		if (auto literal = literal_atom<tagged_value>(result, options.hex_prefix))
+			return std::move(*literal);
+
+		return tagged_value::make_word(symbols().intern(result));
 	}
 
-	auto context::consume_list(std::string_view& sexp_str, bool require_closing_delim) const -> nlohmann::json
+	tagged_value context::read_list(std::string_view& sexp_str, std::pmr::memory_resource* arena, bool view_source, bool require_closing_delim, detail::span_recorder* spans) const
 	{
-		nlohmann::json result = nlohmann::json::array();
+		tagged_value::array_t result(arena ? arena : std::pmr::get_default_resource());
 		trim_whitespace_left(sexp_str);
 		while (!sexp_str.empty() && !starts_with(sexp_str, options.closing_delimiter))
 		{
-			result.push_back(consume_value(sexp_str));
+			result.push_back(read_element(sexp_str, arena, view_source, spans));
 			trim_whitespace_left(sexp_str);
 		}
 		auto closing = consume(sexp_str, options.closing_delimiter);
 		if (require_closing_delim && options.strict_syntax && !closing)
-			return report_error("list must end with closing delimiter");
-		return result;
+			return { report_error("list must end with closing delimiter"), arena };
+		return tagged_value::make_call(std::move(result), arena);
 	}
 
-	auto context::consume_value(std::string_view& sexp_str) const -> nlohmann::json
+	tagged_value context::read_element(std::string_view& sexp_str, std::pmr::memory_resource* arena, bool view_source, detail::span_recorder* spans) const
 	{
 		trim_whitespace_left(sexp_str);
-		if (consume(sexp_str, options.opening_delimiter))
-			return consume_list(sexp_str);
-		return consume_atom(sexp_str);
+		if (!spans)
+		{
+			if (consume(sexp_str, options.opening_delimiter))
+				return read_list(sexp_str, arena, view_source);
+			return read_atom(sexp_str, arena, view_source);
+		}
+
+		const auto span = spans->begin(sexp_str.data());
+		auto result = consume(sexp_str, options.opening_delimiter) ? read_list(sexp_str, arena, view_source, true, spans) : read_atom(sexp_str, arena, view_source);
+		spans->end(span, sexp_str.data());
+		if (!result.has_elements())
+			spans->drop_children(span);
+		return result;
+	}
+
+	auto context::find_variable(std::string_view name) -> std::pair<context*, variable_map::iterator>
+	{
+		/// A name that was never interned cannot be the name of a variable
+		if (const auto sym = symbols().find(name))
+			return find_variable(sym);
+		return {};
 	}
 
-	std::pair<context*, std::map<std::string, json, std::less<>>::iterator> context::find_variable(std::string_view name)
+	auto context::find_variable(symbol name) -> std::pair<context*, variable_map::iterator>
 	{
 		if (auto it = m_context_variables.find(name); it != m_context_variables.end())
 			return std::pair{ this, it };
-		else
-			return parent_context ? parent()->find_variable(name) : std::pair<context*, decltype(it)>{};
+		if (!parent_context)
+			return {};
+
+		/// Frozen contexts can be used by many threads at once, so they cannot update their index
+		if (!parent()->parent_context || m_frozen)
+			return parent()->find_variable(name);
+
+		/// All the parents have children, so any change in their variables changes the epoch
+		if (const auto generation = m_root->m_variable_epoch.load(std::memory_order_relaxed); generation != m_variable_index_generation)
+		{
+			m_variable_index.clear();
+			m_variable_index_generation = generation;
+		}
+
+		if (auto it = m_variable_index.find(name.id); it != m_variable_index.end())
+			return it->second;
+		const auto result = parent()->find_variable(name);
+		m_variable_index.emplace(name.id, result);
+		return result;
 	}
 
 	std::string context::interpolate(std::string_view str)
 	{
 		std::string result;
+		output_sink sink{ result };
+		interpolate_to(sink, str);
+		return result;
+	}
+
+	render_result context::interpolate_with_errors(std::string_view str)
+	{
+		/// Nested renders do not clear the errors of the render they are part of
+		const auto first_error = m_render_depth > 0 ? m_errors.size() : 0;
+		render_result result;
+		result.output = interpolate(str);
+		result.errors.assign(std::make_move_iterator(m_errors.begin() + first_error), std::make_move_iterator(m_errors.end()));
+		m_errors.erase(m_errors.begin() + first_error, m_errors.end());
+		return result;
+	}
+
+	void context::set_render_profiler(translator::render_profiler* profiler)
+	{
+		if (check_not_frozen("set the render profiler"))
+			m_render_profiler = profiler;
+	}
+
+	render_profiler* context::get_render_profiler() const noexcept
+	{
+		for (auto ctx = this; ctx; ctx = ctx->parent())
+		{
+			if (ctx->m_render_profiler)
+				return ctx->m_render_profiler;
+		}
+		return nullptr;
+	}
+
+	/// Parsed templates are recorded in render profiles by their hash, and named by their `json` representation only the first time
+	/// a thread renders them; strings that are not valid UTF-8 are dumped with replacement characters instead of throwing
+	template <typename RENDER>
+	static void measure_parsed(render_profiler& profiler, json const& parsed, output_sink& sink, RENDER&& render)
+	{
+		profiler.measure(std::hash<json>{}(parsed), [&] { return parsed.dump(-1, ' ', false, json::error_handler_t::replace); }, sink, std::forward<RENDER>(render));
+	}
+
+	void context::interpolate_to(output_sink& sink, std::string_view str)
+	{
+		if (const auto profiler = get_render_profiler())
+			return profiler->measure(str, sink, [&] { render_source(sink, str); });
+		render_source(sink, str);
+	}
+
+	void context::render_source(output_sink& sink, std::string_view str)
+	{
+		/// The variables of the template have to be known before it is rendered
+		if (m_unknown_vars_batch_getter && !m_frozen && !options.track_source_spans)
+			return render_parsed(sink, parse(str));
+
+		/// Calls evaluated as they are parsed are moved into their functions, so they would have no spans to refer to
+		if (options.track_source_spans && !m_frozen)
+		{
+			source_map spans;
+			const auto parsed = parse(str, &spans);
+			return render_parsed(sink, parsed, spans);
+		}
+
+		render_scope scope{ *this };
 		while (!str.empty())
 		{
-			result += consume_until(str, options.opening_delimiter);
+			sink.append(consume_until(str, options.opening_delimiter));
 			if (str.empty()) break;
 			str.remove_prefix(1);
 			if (consume(str, options.opening_delimiter))
-				result += options.opening_delimiter;
+				sink.append(options.opening_delimiter);
 			else
 			{
 				json call = consume_list(str);
 				json call_result = safe_eval(std::move(call));
-				result += value_to_string(call_result);
+				append_value(sink, call_result);
 			}
 		}
+	}
+
+	/// Reads a top-level call of a template (whose opening delimiter at `call_start` was already consumed) with `read`,
+	/// recording its span if `spans` is not null
+	template <typename READ>
+	static auto read_top_level_call(std::string_view& str, char const* call_start, detail::span_recorder* spans, READ&& read)
+	{
+		if (!spans)
+			return read();
+		const auto span = spans->begin(call_start);
+		auto result = read();
+		spans->end(span, str.data());
+		/// A call replaced by an error is text, which has no span
+		if (!detail::span_recorder::is_list(result))
+			spans->discard(span);
 		return result;
 	}
 
-	json context::parse(std::string_view str) const
+	json context::parse(std::string_view str, source_map* spans) const
 	{
+		std::optional<detail::span_recorder> recorder;
+		if (spans)
+			recorder.emplace(str);
+
 		json result = json::array();
 		std::string latest_str;
 		while (!str.empty())
 		{
 			latest_str += consume_until(str, options.opening_delimiter);
 			if (str.empty()) break;
+			const auto call_start = str.data();
 			str.remove_prefix(1);
 			if (consume(str, options.opening_delimiter))
 				latest_str += options.opening_delimiter;
@@ -269,92 +533,410 @@ namespace translator
 			{
 				if (!latest_str.empty())
 					result.push_back(std::exchange(latest_str, {}));
-				result.push_back(std::move(consume_list(str)));
+				auto recorder_ptr = recorder ? &*recorder : nullptr;
+				result.push_back(read_top_level_call(str, call_start, recorder_ptr, [&] { return consume_list(str, true, recorder_ptr); }));
 			}
 		}
 		if (!latest_str.empty())
 			result.push_back(std::move(latest_str));
+
+		if (recorder)
+			recorder->assign_calls(result, *spans);
 		return result;
 	}
 
-	json context::parse_call(std::string_view str) const
+	tagged_value context::parse_value(std::string_view str, std::pmr::memory_resource* arena, bool view_source, source_map* spans) const
 	{
-		auto result = consume_list(str, false);
+		std::optional<detail::span_recorder> recorder;
+		if (spans)
+			recorder.emplace(str);
+		const auto recorder_ptr = recorder ? &*recorder : nullptr;
+
+		tagged_value::array_t result(arena ? arena : std::pmr::get_default_resource());
+
+		/// Text between calls is taken from `str` in one piece; only text with escaped opening delimiters has to be rewritten
+		const auto add_text = [&](std::string_view text, bool escaped) {
+			if (text.empty())
+				return;
+			if (!escaped)
+			{
+				result.push_back(read_text(text, arena, view_source));
+				return;
+			}
+
+			std::string unescaped;
+			unescaped.reserve(text.size());
+			for (size_t i = 0; i < text.size(); ++i)
+			{
+				unescaped += text[i];
+				if (text[i] == options.opening_delimiter && i + 1 < text.size() && text[i + 1] == options.opening_delimiter)
+					++i;
+			}
+			result.emplace_back(unescaped, arena);
+		};
+
+		const auto str_end = str.data() + str.size();
+		auto text_start = str.data();
+		bool escaped = false;
+		while (!str.empty())
+		{
+			consume_until(str, options.opening_delimiter);
+			if (str.empty()) break;
+			const auto text_end = str.data();
+			str.remove_prefix(1);
+			if (consume(str, options.opening_delimiter))
+				escaped = true;
+			else
+			{
+				add_text({ text_start, size_t(text_end - text_start) }, std::exchange(escaped, false));
+				result.push_back(read_top_level_call(str, text_end, recorder_ptr, [&] { return read_list(str, arena, view_source, true, recorder_ptr); }));
+				text_start = str.data();
+			}
+		}
+		add_text({ text_start, size_t(str_end - text_start) }, escaped);
+
+		auto parsed = tagged_value::make_array(std::move(result), arena);
+		if (recorder)
+			recorder->assign_calls(parsed, *spans);
+		return parsed;
+	}
+
+	parsed_template context::parse_template(std::string_view str, std::pmr::memory_resource* upstream) const
+	{
+		parsed_template result{ upstream };
+
+		/// The template keeps its own copy of the source, so that its text can refer to it instead of being copied piece by piece
+		const auto source = static_cast<char*>(result.arena()->allocate(str.size(), 1));
+		std::copy(str.begin(), str.end(), source);
+		result.m_source = { source, str.size() };
+
+		result.m_root = parse_value(result.m_source, result.arena(), true, options.track_source_spans ? &result.m_spans : nullptr);
+		return result;
+	}
+
+	json context::parse_call(std::string_view str, source_map* spans) const
+	{
+		std::optional<detail::span_recorder> recorder;
+		if (spans)
+			recorder.emplace(str);
+
+		auto result = consume_list(str, false, recorder ? &*recorder : nullptr);
 		if (!str.empty())
 			return report_error("Additional tokens after end of list: " + std::string{ str });
+		if (recorder && result.is_array())
+			recorder->assign_elements(result, *spans);
 		return result;
 	}
 
 	std::string context::interpolate_parsed(json const& parsed)
 	{
 		std::string result;
-		if (!parsed.is_array())
-			return report_error("Invalid parsed value: must be an array of strings or call arrays");
+		output_sink sink{ result };
+		interpolate_parsed_to(sink, parsed);
+		return result;
+	}
+
+	std::string context::interpolate_parsed(json&& parsed)
+	{
+		std::string result;
+		output_sink sink{ result };
+		interpolate_parsed_to(sink, std::move(parsed));
+		return result;
+	}
+
+	/// The output of an invalid parsed value is just the error, so it has to be checked before anything is written
+	static bool is_valid_parsed(json const& parsed)
+	{
+		return parsed.is_array() && std::all_of(parsed.begin(), parsed.end(), [](json const& r) { return r.is_array() || r.is_string(); });
+	}
+
+	void context::interpolate_parsed_to(output_sink& sink, json const& parsed)
+	{
+		if (const auto profiler = get_render_profiler())
+			return measure_parsed(*profiler, parsed, sink, [&] { render_parsed(sink, parsed); });
+		render_parsed(sink, parsed);
+	}
+
+	void context::interpolate_parsed_to(output_sink& sink, json&& parsed)
+	{
+		if (const auto profiler = get_render_profiler())
+			return measure_parsed(*profiler, parsed, sink, [&] { render_parsed(sink, std::move(parsed)); });
+		render_parsed(sink, std::move(parsed));
+	}
+
+	void context::interpolate_parsed_to(output_sink& sink, json const& parsed, source_map const& spans)
+	{
+		if (const auto profiler = get_render_profiler())
+			return measure_parsed(*profiler, parsed, sink, [&] { render_parsed(sink, parsed, spans); });
+		render_parsed(sink, parsed, spans);
+	}
+
+	void context::render_parsed(output_sink& sink, json const& parsed)
+	{
+		if (!is_valid_parsed(parsed))
+			return sink.append(report_error("Invalid parsed value: must be an array of strings or call arrays"));
+		render_scope scope{ *this };
+		if (m_unknown_vars_batch_getter)
+			prefetch_unknown_vars(referenced_variables(parsed));
 		for (auto const& r : parsed)
 		{
 			if (r.is_array())
 			{
 				json call_result = safe_eval(r);
-				result += value_to_string(call_result);
+				append_value(sink, call_result);
 			}
-			else if (r.is_string())
-				result += r.get_ref<json::string_t const&>();
 			else
-				return report_error("Invalid parsed value: must be an array of strings or call arrays");
+				sink.append(r.get_ref<json::string_t const&>());
 		}
-		return result;
 	}
 
-	std::string context::interpolate_parsed(json&& parsed)
+	std::string context::interpolate_parsed(json const& parsed, source_map const& spans)
 	{
 		std::string result;
-		if (!parsed.is_array())
-			return report_error("Invalid parsed value: must be an array of strings or call arrays");
+		output_sink sink{ result };
+		interpolate_parsed_to(sink, parsed, spans);
+		return result;
+	}
+
+	void context::render_parsed(output_sink& sink, json const& parsed, source_map const& spans)
+	{
+		/// Frozen contexts are shared between threads, so they cannot hold on to the spans
+		if (m_frozen)
+			return render_parsed(sink, parsed);
+
+		const auto previous = std::exchange(m_source_map, &spans);
+		try
+		{
+			render_parsed(sink, parsed);
+		}
+		catch (...)
+		{
+			m_source_map = previous;
+			throw;
+		}
+		m_source_map = previous;
+	}
+
+	void context::render_parsed(output_sink& sink, json&& parsed)
+	{
+		if (!is_valid_parsed(parsed))
+			return sink.append(report_error("Invalid parsed value: must be an array of strings or call arrays"));
+		render_scope scope{ *this };
+		if (m_unknown_vars_batch_getter)
+			prefetch_unknown_vars(referenced_variables(parsed));
 		for (auto&& r : std::move(parsed))
 		{
 			if (r.is_array())
 			{
 				json call_result = safe_eval(std::move(r));
-				result += value_to_string(call_result);
+				append_value(sink, call_result);
 			}
-			else if (r.is_string())
+			else
+				sink.append(r.get_ref<json::string_t const&>());
+		}
+	}
+
+	static void collect_variables(context const& ctx, json const& call, std::vector<symbol>& result)
+	{
+		for (auto const& arg : call)
+		{
+			if (arg.is_array())
+				collect_variables(ctx, arg, result);
+			else if (arg.is_string())
 			{
-				std::string el = std::move(r.get_ref<json::string_t&>());
-				result += std::move(el);
+				if (const auto name = std::string_view{ arg }; name.size() > 1 && name[0] == ctx.options.var_symbol)
+					result.push_back(ctx.symbols().intern(name.substr(1)));
 			}
-			else
-				return report_error("Invalid parsed value: must be an array of strings or call arrays");
 		}
+	}
+
+	std::vector<symbol> context::referenced_variables(json const& parsed) const
+	{
+		std::vector<symbol> result;
+		if (!parsed.is_array())
+			return result;
+		/// Top-level strings are literal text
+		for (auto const& r : parsed)
+		{
+			if (r.is_array())
+				collect_variables(*this, r, result);
+		}
+		std::sort(result.begin(), result.end(), [](symbol a, symbol b) { return a.id < b.id; });
+		result.erase(std::unique(result.begin(), result.end()), result.end());
 		return result;
 	}
 
 	std::string context::report_error(std::string_view error) const
 	{
+		/// Calls whose arguments were handed over to their functions have no spans, so the error is placed at the innermost call that has one
+		std::optional<source_span> span;
+		if (options.maintain_call_stack)
+		{
+			for (auto frame = m_call_stack.rbegin(); frame != m_call_stack.rend() && !span; ++frame)
+				span = call_span(*frame);
+		}
+		/// Frozen contexts can be shared by threads, so they cannot record errors; they report them as if `errors_as_values` was not set
+		if (options.errors_as_values && !m_frozen)
+		{
+			auto& recorded = m_errors.emplace_back();
+			recorded.message = error;
+			if (options.maintain_call_stack && !m_call_stack.empty())
+				recorded.call = describe_call(m_call_stack.back());
+			recorded.span = span;
+			return recorded.message;
+		}
+
+		/// Errors that are not recorded can only carry the position of their call in the message
+		std::string located;
+		if (span)
+		{
+			located = format("{}:{}: {}", span->line, span->column, error);
+			error = located;
+		}
 		if (m_error_handler)
 			return m_error_handler(*this, error);
 		throw std::runtime_error(std::string{ error });
 	}
 
+	json context::error_value(std::string_view error) const
+	{
+		auto message = report_error(error);
+		if (options.errors_as_values)
+			return make_error_value(message);
+		return message;
+	}
+
+	void context::throw_error(std::string_view error) const
+	{
+		if (options.errors_as_values)
+			throw e_error_value{ error_value(error) };
+		throw std::runtime_error{ report_error(error) };
+	}
+
+	void context::freeze() noexcept
+	{
+		for (auto ctx = this; ctx; ctx = ctx->parent())
+			ctx->m_frozen = true;
+		symbols().make_thread_safe();
+	}
+
+	bool context::check_not_frozen(std::string_view what) const
+	{
+		if (!m_frozen)
+			return true;
+		report_error(format("cannot {} in a frozen context; use a child context instead", what));
+		return false;
+	}
+
 	json context::user_var(std::string_view name)
 	{
 		auto [owning_context, iterator] = find_variable(name);
 		if (owning_context)
 			return iterator->second;
-		return m_unknown_var_value_getter ? m_unknown_var_value_getter(*this, name) : nullptr;
+		return unknown_var(name);
+	}
+
+	json context::user_var(symbol name)
+	{
+		auto [owning_context, iterator] = find_variable(name);
+		if (owning_context)
+			return iterator->second;
+		return unknown_var(symbols().name(name));
+	}
+
+	json context::unknown_var(std::string_view name)
+	{
+		if (m_render_depth == 0)
+			return m_unknown_var_value_getter ? m_unknown_var_value_getter(*this, name) : nullptr;
+
+		/// Prefetched values are used even if `memoize_unknown_vars` is not set
+		if (auto it = m_unknown_var_memo.find(name); it != m_unknown_var_memo.end())
+			return it->second;
+		if (!m_unknown_var_value_getter)
+			return nullptr;
+		if (!options.memoize_unknown_vars)
+			return m_unknown_var_value_getter(*this, name);
+		/// If the getter throws, nothing is memoized
+		auto value = m_unknown_var_value_getter(*this, name);
+		m_unknown_var_memo.emplace(std::string{ name }, value);
+		return value;
+	}
+
+	void context::prefetch_unknown_vars(std::vector<symbol> const& names)
+	{
+		if (!m_unknown_vars_batch_getter || m_render_depth == 0)
+			return;
+
+		auto const& symbols = this->symbols();
+		m_prefetch_names.clear();
+		for (auto const name : names)
+		{
+			const auto name_str = symbols.name(name);
+			if (!find_variable(name).first && m_unknown_var_memo.find(name_str) == m_unknown_var_memo.end())
+				m_prefetch_names.push_back(name_str);
+		}
+		if (m_prefetch_names.empty())
+			return;
+
+		m_prefetch_values.assign(m_prefetch_names.size(), json(json::value_t::discarded));
+		m_unknown_vars_batch_getter(*this, m_prefetch_names, m_prefetch_values);
+		for (size_t i = 0; i < m_prefetch_names.size() && i < m_prefetch_values.size(); ++i)
+		{
+			if (!m_prefetch_values[i].is_discarded())
+				m_unknown_var_memo.emplace(std::string{ m_prefetch_names[i] }, std::move(m_prefetch_values[i]));
+		}
+		m_prefetch_values.clear();
+	}
+
+	void context::reset_evaluation_state() noexcept
+	{
+		assert(m_render_depth == 0);
+		m_call_stack.clear();
+		m_value_stack.clear();
+		m_pending_terminator = scope_terminator::none;
+		m_errors.clear();
+	}
+
+	/// Frozen contexts are shared between threads, and cannot evaluate anything anyway, so they do not memoize
+	context::render_scope::render_scope(context& ctx) noexcept
+		: m_context(ctx.m_frozen ? nullptr : &ctx)
+	{
+		if (m_context && m_context->m_render_depth++ == 0)
+		{
+			m_context->m_errors.clear();
+			/// Frames can only be left over by calls made outside of renders; they may point into templates that no longer exist
+			m_context->m_call_stack.clear();
+			m_context->m_pending_terminator = scope_terminator::none;
+		}
+	}
+
+	context::render_scope::~render_scope()
+	{
+		if (m_context && --m_context->m_render_depth == 0)
+			m_context->m_unknown_var_memo.clear();
 	}
 
 	json& context::set_user_var(std::string_view name, json val, bool force_local)
 	{
+		if (!check_not_frozen("set variables"))
+		{
+			/// The error handler chose to continue, so the value goes nowhere
+			static thread_local json discarded;
+			return discarded = std::move(val);
+		}
+
+		const auto sym = symbols().intern(name);
 		auto* storage = &m_context_variables;
 		if (!force_local)
 		{
-			auto [owning_store, it] = find_variable(name);
-			if (owning_store)
+			/// Variables of frozen parents are shadowed instead
+			auto [owning_store, it] = find_variable(sym);
+			if (owning_store && !owning_store->m_frozen)
 				storage = &owning_store->m_context_variables;
 		}
-		auto it = storage->find(name);
+		auto it = storage->find(sym);
 		if (it == storage->end())
-			return storage->emplace(name, std::move(val)).first->second;
+			return storage->emplace(sym, std::move(val)).first->second;
 		return it->second = std::move(val);
 	}
 
@@ -367,46 +949,70 @@ namespace translator
 	}
 
 	json context::eval_list(std::vector<json> args)
+	{
+		return eval_list(std::move(args), nullptr);
+	}
+
+	json context::eval_list(std::vector<json> args, json const* call_node)
 	{
 		if (args.empty())
 			return nullptr;
 
+		if (!check_not_frozen("evaluate calls"))
+			return nullptr;
+
 		if (args.size() == 1 && args[0].is_string() && !args[0].empty() && std::string_view{ args[0] } [0] == options.var_symbol)
 			return user_var(std::string_view{ args[0] }.substr(1));
 
-		auto function_candidates = this->find_functions(args);
-		if (function_candidates.empty())
+		defined_function const* func = parameter_symbols(args, m_parameter_names) ? dispatch(m_parameter_names, args.size()) : nullptr;
+		if (!func)
 		{
-			if (auto unknown = get_unknown_func_handler())
+			/// The call resolves to no function, or to several of them; search again to find out which
+			auto function_candidates = this->find_functions(args);
+			if (function_candidates.empty())
 			{
-				return call(unknown, std::move(args), array_to_string(args));
+				if (auto unknown = get_unknown_func_handler())
+				{
+					return call(unknown, std::move(args), frame_for(call_node));
+				}
+				else
+				{
+					std::vector<std::string> signatures; /// = find_closest(args) | transform(to_signature)
+					if (signatures.empty())
+						return error_value(format("function for call '{}' not found", array_to_string(args)));
+					else
+						return error_value(format("function for call '{}' not found, did you mean:\n{}?", array_to_string(args), join(signatures, "?\n")));
+				}
 			}
-			else
+			else if (function_candidates.size() > 1)
 			{
-				std::vector<std::string> signatures; /// = find_closest(args) | transform(to_signature)
-				if (signatures.empty())
-					return report_error(format("function for call '{}' not found", array_to_string(args)));
-				else
-					return report_error(format("function for call '{}' not found, did you mean:\n{}?", array_to_string(args), join(signatures, "?\n")));
+				std::vector<std::string> signatures;
+				for (auto& candidate : function_candidates)
+					signatures.emplace_back(candidate->signature);
+				return error_value(format("multiple functions for call '{}' found: {}", array_to_string(args), 
+					join(signatures, ", ", [](auto sig) { return format("[{}]", sig); })));
 			}
+			func = function_candidates[0];
 		}
-		else if (function_candidates.size() > 1)
-		{
-			std::vector<std::string> signatures;
-			for (auto& candidate : function_candidates)
-				signatures.push_back(candidate->signature);
-			return report_error(format("multiple functions for call '{}' found: {}", array_to_string(args), 
-				join(signatures, ", ", [](auto sig) { return format("[{}]", sig); })));
-		}
-		const auto func = function_candidates[0];
 		assert(func);
 
-		std::string call_frame_desc;
-		if (options.maintain_call_stack && options.call_stack_store_call_string)
-			call_frame_desc = array_to_string(args);
 
 		const auto elem_count = args.size();
 		const bool infix = (elem_count % 2) == 1;
+
+		/// Native functions take their arguments in place, so they are just moved to the front of the call
+		if (func->native_func)
+		{
+			size_t arg_count = 0;
+			if (elem_count > 1)
+			{
+				arg_count = infix;
+				for (size_t i = infix; i < elem_count; i += 2)
+					args[arg_count++] = std::move(args[i + 1]);
+			}
+			return call(func, args.data(), arg_count, frame_for(call_node));
+		}
+
 		//std::vector<json const*> parameter_names;
 		std::vector<json> arguments;
 		if (elem_count > 1) /// Hack for calling a one-optional-param prefix function with no parameters
@@ -428,21 +1034,22 @@ namespace translator
 			arguments.push_back(std::move(args[i + 1]));
 		}
 	
-		return call(func, std::move(arguments), std::move(call_frame_desc));
+		return call(func, std::move(arguments), frame_for(call_node));
 	}
 
-	json context::call(defined_function const* func, std::vector<json> arguments, std::string call_frame_desc)
+	json context::call(defined_function const* func, std::vector<json> arguments, call_stack_element frame)
 	{
 		assert(func);
 		assert(func->func);
 
-		if (options.maintain_call_stack)
-		{
-			auto& call_frame = m_call_stack.emplace_back();
-			call_frame.actual_function = func;
-			if (options.call_stack_store_call_string)
-				call_frame.debug_call_sig = std::move(call_frame_desc);
-		}
+		if (func->native_func)
+			return call(func, arguments.data(), arguments.size(), frame);
+
+		if (!check_not_frozen("evaluate calls"))
+			return nullptr;
+
+		call_frame_scope call_frame{ *this, func, frame };
+		profile_scope profile{ *this, func, arguments.size() };
 
 		/// TODO: This
 		//auto prev_parameter_names = std::exchange(m_parameter_names, &parameters);
@@ -451,14 +1058,40 @@ namespace translator
 		{
 			result = func->func(*this, std::move(arguments));
 		}
+		catch (e_error_value& e)
+		{
+			result = std::move(e.error);
+		}
 		catch (...)
 		{
 			//m_parameter_names = prev_parameter_names;
 			throw;
 		}
 
-		if (options.maintain_call_stack)
-			m_call_stack.pop_back();
+		return result;
+	}
+
+	json context::call(defined_function const* func, json* arguments, size_t arg_count, call_stack_element frame)
+	{
+		assert(func);
+		if (!func->native_func)
+			return call(func, std::vector<json>{ std::make_move_iterator(arguments), std::make_move_iterator(arguments + arg_count) }, frame);
+
+		if (!check_not_frozen("evaluate calls"))
+			return nullptr;
+
+		call_frame_scope call_frame{ *this, func, frame };
+		profile_scope profile{ *this, func, arg_count };
+
+		json result;
+		try
+		{
+			result = func->native_func(*this, { arguments, arg_count });
+		}
+		catch (e_error_value& e)
+		{
+			result = std::move(e.error);
+		}
 
 		return result;
 	}
@@ -470,36 +1103,82 @@ namespace translator
 		return j.dump();
 	}
 
+	void context::append_value(output_sink& sink, json const& j) const
+	{
+		using default_func_type = std::string(*)(context const&, json const&);
+		/// The error was recorded when it was reported
+		if (options.errors_as_values && is_error_value(j))
+			return;
+		if (m_json_value_append_func)
+			m_json_value_append_func(*this, j, sink);
+		else if (!m_json_value_to_str_func)
+			sink.append(j.dump());
+		else if (auto func = m_json_value_to_str_func.target<default_func_type>(); func && *func == &default_json_value_to_str_func)
+			default_json_value_append_func(*this, j, sink);
+		else
+			sink.append(m_json_value_to_str_func(*this, j));
+	}
+
 	std::string context::array_to_string(std::vector<json> const& arguments) const
 	{
 		return format("{}{}{}", options.opening_delimiter, join(arguments, " ", [this](json const& v) { return value_to_string(v); }), options.closing_delimiter);
 	}
 
+	std::string context::describe_call(call_stack_element const& frame) const
+	{
+		if (frame.call && frame.call->is_array())
+			return array_to_string(frame.call->get_ref<json::array_t const&>());
+		if (frame.compiled_call)
+		{
+			const auto call = frame.compiled_call->to_json(symbols());
+			if (call.is_array())
+				return array_to_string(call.get_ref<json::array_t const&>());
+		}
+		if (frame.actual_function)
+			return format("{}{}{}", options.opening_delimiter, frame.actual_function->signature, options.closing_delimiter);
+		return {};
+	}
+
+	std::optional<source_span> context::call_span(call_stack_element const& frame) const
+	{
+		if (frame.span)
+			return *frame.span;
+		if (frame.call && m_source_map)
+			return m_source_map->find(*frame.call);
+		return std::nullopt;
+	}
+
 
 	/// TODO: These functions use array_to_string(args) to determine the function signature, which is not correct
 	
 	void context::assert_args(std::vector<json> const& args, size_t arg_count) const
 	{
 		if (args.size() != arg_count)
-			throw std::runtime_error{ report_error(format("function {} requires exactly {} arguments, {} given", array_to_string(args), arg_count, args.size())) };
+			throw_error(format("function {} requires exactly {} arguments, {} given", array_to_string(args), arg_count, args.size()));
+	}
+
+	void context::assert_args(argument_span args, size_t arg_count) const
+	{
+		if (args.size() != arg_count)
+			throw_error(format("function {} requires exactly {} arguments, {} given", array_to_string({ args.begin(), args.end() }), arg_count, args.size()));
 	}
 
 	void context::assert_args(std::vector<json> const& args, size_t min_args, size_t max_args) const
 	{
 		if (args.size() < min_args && args.size() >= max_args)
-			throw std::runtime_error{ report_error(format("function {} requires between {} and {} arguments, {} given", array_to_string(args), min_args, max_args, args.size())) };
+			throw_error(format("function {} requires between {} and {} arguments, {} given", array_to_string(args), min_args, max_args, args.size()));
 	}
 
 	void context::assert_min_args(std::vector<json> const& args, size_t arg_count) const
 	{
 		if (args.size() < arg_count)
-			throw std::runtime_error{ report_error(format("function {} requires at least {} arguments, {} given", array_to_string(args), arg_count, args.size())) };
+			throw_error(format("function {} requires at least {} arguments, {} given", array_to_string(args), arg_count, args.size()));
 	}
 
 	json::value_t context::assert_arg(std::vector<json> const& args, size_t arg_num, json::value_t type) const
 	{
 		if (arg_num >= args.size())
-			throw std::runtime_error{ report_error(format("function {} requires {} arguments, {} given", array_to_string(args), arg_num, args.size())) };
+			throw_error(format("function {} requires {} arguments, {} given", array_to_string(args), arg_num, args.size()));
 
 		return assert_arg(args[arg_num], args, arg_num, type);
 	}
@@ -508,15 +1187,21 @@ namespace translator
 	{
 		if (type != json::value_t::discarded && value.type() != type)
 		{
+			/// Propagate the error instead of reporting a new one
+			if (options.errors_as_values && is_error_value(value))
+				throw e_error_value{ value };
+			/// The argument was cut short by a terminator, which should just keep returning
+			if (m_pending_terminator != scope_terminator::none)
+				throw e_error_value{ nullptr };
 			if (options.maintain_call_stack)
 			{
 				auto& entry = m_call_stack.back();
 
-				throw std::runtime_error{ report_error(format("argument {} to function {} must be of type {}, {} given",
-					arg_num, entry.actual_function->signature, json(type).type_name(), value.type_name())) };
+				throw_error(format("argument {} to function {} must be of type {}, {} given",
+					arg_num, entry.actual_function->signature, json(type).type_name(), value.type_name()));
 			}
-			throw std::runtime_error{ report_error(format("argument {} to function must be of type {}, {} given",
-				arg_num, json(type).type_name(), value.type_name())) };
+			throw_error(format("argument {} to function must be of type {}, {} given",
+				arg_num, json(type).type_name(), value.type_name()));
 		}
 		return value.type();
 	}
@@ -524,7 +1209,7 @@ namespace translator
 	json context::eval_arg_steal(std::vector<json>& args, size_t arg_num, json::value_t type)
 	{
 		if (arg_num >= args.size())
-			throw std::runtime_error{ report_error(format("function {} requires {} arguments, {} given", array_to_string(args), arg_num, args.size())) };
+			throw_error(format("function {} requires {} arguments, {} given", array_to_string(args), arg_num, args.size()));
 
 		auto result = eval(std::move(args[arg_num]));
 		assert_arg(result, args, arg_num, type);
@@ -534,7 +1219,7 @@ namespace translator
 	json context::eval_arg_copy(std::vector<json> const& args, size_t arg_num, json::value_t type)
 	{
 		if (arg_num >= args.size())
-			throw std::runtime_error{ report_error(format("function {} requires {} arguments, {} given", array_to_string(args), arg_num, args.size())) };
+			throw_error(format("function {} requires {} arguments, {} given", array_to_string(args), arg_num, args.size()));
 
 		auto result = eval(args[arg_num]);
 		assert_arg(result, args, arg_num, type);
@@ -562,6 +1247,9 @@ namespace translator
 
 	json context::eval(json const& val)
 	{
+		if (m_pending_terminator != scope_terminator::none)
+			return nullptr;
+
 		if (val.is_string())
 		{
 			if (auto str = std::string_view{ val }; starts_with(str, options.var_symbol))
@@ -571,16 +1259,30 @@ namespace translator
 		if (!val.is_array())
 			return val;
 
-		return eval_list(val.get_ref<json::array_t const&>());
+		return eval_list(val.get_ref<json::array_t const&>(), &val);
 	}
 
+	/// Evaluates `val` in place, so that the call stack can refer to its calls
 	json context::safe_eval(json const& val)
 	{
-		return safe_eval(json{ val });
+		try
+		{
+			auto result = eval(val);
+			if (m_pending_terminator != scope_terminator::none)
+				return report_unhandled_terminator();
+			return result;
+		}
+		catch (e_scope_terminator const& e)
+		{
+			return report_error(format("'{}' not in loop", e.type()));
+		}
 	}
 
 	json context::eval(json&& val)
 	{
+		if (m_pending_terminator != scope_terminator::none)
+			return nullptr;
+
 		if (val.is_string())
 		{
 			if (auto str = std::string_view{ val }; starts_with(str, options.var_symbol))
@@ -597,7 +1299,10 @@ namespace translator
 	{
 		try
 		{
-			return eval(std::move(value));
+			auto result = eval(std::move(value));
+			if (m_pending_terminator != scope_terminator::none)
+				return report_unhandled_terminator();
+			return result;
 		}
 		catch (e_scope_terminator const& e)
 		{
@@ -605,4 +1310,44 @@ namespace translator
 		}
 	}
 
+	void context::terminate_scope(scope_terminator kind, json result)
+	{
+		m_pending_terminator = kind;
+		m_terminator_result = std::move(result);
+	}
+
+	bool context::end_loop_iteration() noexcept
+	{
+		switch (m_pending_terminator)
+		{
+		case scope_terminator::none:
+			return false;
+		case scope_terminator::continue_loop:
+			m_pending_terminator = scope_terminator::none;
+			return false;
+		case scope_terminator::break_loop:
+			m_pending_terminator = scope_terminator::none;
+			return true;
+		default:
+			return true;
+		}
+	}
+
+	json context::take_return_value(json result)
+	{
+		if (m_pending_terminator != scope_terminator::return_value)
+			return result;
+		m_pending_terminator = scope_terminator::none;
+		return std::exchange(m_terminator_result, nullptr);
+	}
+
+	std::string context::report_unhandled_terminator()
+	{
+		const auto kind = std::exchange(m_pending_terminator, scope_terminator::none);
+		m_terminator_result = nullptr;
+		if (kind == scope_terminator::return_value)
+			return report_error("'return' not in function");
+		return report_error(format("'{}' not in loop", kind == scope_terminator::break_loop ? "break" : "continue"));
+	}
+
 }
@@ -12,6 +12,12 @@ namespace translator {
 		return new cpp_context{};
 	}
 
+	translator_context* translator_new_child_context(translator_context* parent)
+	{
+		assert(parent);
+		return new cpp_context{ (cpp_context*)parent };
+	}
+
 	void translator_init_context_options(translator_context* context)
 	{
 		assert(context);
@@ -29,6 +35,18 @@ namespace translator {
 		delete self;
 	}
 
+	void translator_freeze_context(translator_context* context)
+	{
+		assert(context);
+		self->freeze();
+	}
+
+	bool translator_is_context_frozen(translator_context const* context)
+	{
+		assert(context);
+		return ((cpp_context const*)context)->frozen();
+	}
+
 	using nlohmann::json;
 
 	static value to_value(json j)
@@ -61,13 +79,34 @@ namespace translator {
 	static auto bind_c_eval_func(translator_eval_func func, void* func_user_data)
 	{
 		return [func, func_user_data](cpp_context& in_contxt, std::vector<json> arguments) {
-			std::vector<value_ref> value_copies(arguments.size());
+			std::vector<value_ref> value_copies;
+			value_copies.reserve(arguments.size());
 			for (auto& argument : arguments)
 				value_copies.push_back(to_value_ref(argument));
 			return take_result(func(&in_contxt, value_copies.data(), (int)value_copies.size(), func_user_data));
 			};
 	}
 
+	/// Like `bind_c_eval_func`, but the arguments are passed in place, and the references to them are kept on the stack for most calls
+	static native_eval_func bind_c_native_func(translator_eval_func func, void* func_user_data)
+	{
+		return [func, func_user_data](cpp_context& in_context, argument_span arguments) {
+			constexpr size_t max_inline_args = 8;
+			if (arguments.size() <= max_inline_args)
+			{
+				value_ref refs[max_inline_args];
+				for (size_t i = 0; i < arguments.size(); ++i)
+					refs[i] = to_value_ref(arguments[i]);
+				return take_result(func(&in_context, refs, (int)arguments.size(), func_user_data));
+			}
+			std::vector<value_ref> refs;
+			refs.reserve(arguments.size());
+			for (auto& argument : arguments)
+				refs.push_back(to_value_ref(argument));
+			return take_result(func(&in_context, refs.data(), (int)refs.size(), func_user_data));
+		};
+	}
+
 	void translator_set_unknown_func_eval(translator_context* context, translator_eval_func func, void* func_user_data)
 	{
 		assert(context);
@@ -90,6 +129,29 @@ namespace translator {
 			self->unknown_var_value_getter() = {};
 	}
 
+	void translator_set_unknown_vars_batch_getter(translator_context* context, var_batch_getter_func func, void* user_data)
+	{
+		assert(context);
+		if (func)
+		{
+			self->unknown_vars_batch_getter() = [func, user_data](cpp_context& in_context, std::vector<std::string_view> const& names, std::vector<json>& values) {
+				/// Names come from the symbol table, which stores them as null-terminated strings
+				std::vector<const char*> c_names(names.size());
+				for (size_t i = 0; i < names.size(); ++i)
+					c_names[i] = names[i].data();
+				std::vector<value> c_values(names.size());
+				func(&in_context, c_names.data(), (int)c_names.size(), c_values.data(), user_data);
+				for (size_t i = 0; i < c_values.size(); ++i)
+				{
+					if (c_values[i])
+						values[i] = take_result(c_values[i]);
+				}
+			};
+		}
+		else
+			self->unknown_vars_batch_getter() = {};
+	}
+
 	void translator_set_error_handler(translator_context* context, error_handler_func func, void* user_data)
 	{
 		assert(context);
@@ -103,6 +165,69 @@ namespace translator {
 			self->error_handler() = {};
 	}
 
+	int translator_error_count(translator_context const* context)
+	{
+		assert(context);
+		return int(((cpp_context const*)context)->errors().size());
+	}
+
+	const char* translator_error_message(translator_context const* context, int index)
+	{
+		assert(context);
+		assert(index >= 0 && size_t(index) < ((cpp_context const*)context)->errors().size());
+		return ((cpp_context const*)context)->errors()[index].message.c_str();
+	}
+
+	const char* translator_error_call(translator_context const* context, int index)
+	{
+		assert(context);
+		assert(index >= 0 && size_t(index) < ((cpp_context const*)context)->errors().size());
+		return ((cpp_context const*)context)->errors()[index].call.c_str();
+	}
+
+	int translator_function_profiles(translator_context const* context, translator_function_profile* profiles, int max_profiles)
+	{
+		assert(context);
+		static_assert(function_profile::arg_count_buckets == TRANSLATOR_PROFILE_ARG_COUNT_BUCKETS);
+		const auto snapshot = ((cpp_context const*)context)->function_profiles();
+		for (size_t i = 0; i < snapshot.size() && int(i) < max_profiles; ++i)
+		{
+			auto const& profile = snapshot[i];
+			auto& out = profiles[i];
+			out.signature = profile.signature.data();
+			out.signature_length = int(profile.signature.size());
+			out.calls = profile.calls;
+			out.inclusive_time_ns = (unsigned long long)profile.inclusive_time.count();
+			out.exclusive_time_ns = (unsigned long long)profile.exclusive_time.count();
+			std::copy(profile.calls_by_arg_count.begin(), profile.calls_by_arg_count.end(), out.calls_by_arg_count);
+		}
+		return int(snapshot.size());
+	}
+
+	void translator_flush_function_profiles(translator_context* context)
+	{
+		assert(context);
+		((cpp_context*)context)->flush_function_profiles();
+	}
+
+	void translator_reset_function_profiles(translator_context* context)
+	{
+		assert(context);
+		((cpp_context*)context)->reset_function_profiles();
+	}
+
+	bool translator_error_position(translator_context const* context, int index, int* line, int* column)
+	{
+		assert(context);
+		assert(index >= 0 && size_t(index) < ((cpp_context const*)context)->errors().size());
+		auto const& span = ((cpp_context const*)context)->errors()[index].span;
+		if (!span)
+			return false;
+		if (line) *line = int(span->line);
+		if (column) *column = int(span->column);
+		return true;
+	}
+
 	value_ref translator_set_user_var(translator_context* context, const char* name, value_ref v)
 	{
 		assert(context);
@@ -124,7 +249,7 @@ namespace translator {
 		assert(signature);
 		assert(func);
 		//self->functions[name] = bind_c_eval_func(func, func_user_data);
-		self->bind_function(signature, bind_c_eval_func(func, func_user_data));
+		self->bind_function(signature, bind_c_native_func(func, func_user_data));
 	}
 	/*
 
@@ -179,14 +304,21 @@ namespace translator {
 		auto [owner, it] = self->find_variable(name);
 		if (!owner) return;
 
-		if (!only_local || context == owner)
+		if (only_local && context != owner)
+			return;
+		if (owner->frozen())
+			self->report_error("cannot remove variables of a frozen context");
+		else
 			owner->context_variables().erase(it);
 	}
 
 	void translator_clear_local_user_vars(translator_context* context)
 	{
 		assert(context);
-		self->context_variables().clear();
+		if (self->frozen())
+			self->report_error("cannot remove variables of a frozen context");
+		else
+			self->context_variables().clear();
 	}
 
 	bool translator_is_var_local(translator_context* context, const char* name)
@@ -214,9 +346,11 @@ namespace translator {
 	{
 		assert(context);
 		if (!str || !out_buf || buf_size < 1) return nullptr;
-		const auto result = self->interpolate(str);
-		if (strncpy_s(out_buf, (size_t)buf_size, result.data(), result.size()) == 0)
+		output_sink sink{ out_buf, (size_t)buf_size };
+		self->interpolate_to(sink, str);
+		if (!sink.truncated())
 			return out_buf;
+		out_buf[0] = 0;
 		return nullptr;
 	}
 
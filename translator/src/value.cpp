@@ -0,0 +1,198 @@
+#include "../include/ghassanpl/translator/detail/value.h"
+#include <limits>
+
+namespace translator
+{
+	tagged_value::tagged_value(tagged_value const& other) : tagged_value()
+	{
+		switch (other.type())
+		{
+		case kind::string:
+		case kind::error:
+			set_text(other.type(), other.str());
+			break;
+		case kind::call:
+		case kind::array:
+			m_large.tag = other.type();
+			m_large.payload.elements = new array_t(other.elements());
+			break;
+		case kind::object:
+			m_large.tag = kind::object;
+			m_large.payload.object = new object_t(other.members());
+			break;
+		default:
+			/// Everything else is trivially copyable
+			std::memcpy((void*)this, (void const*)&other, sizeof(tagged_value));
+			break;
+		}
+	}
+
+	tagged_value& tagged_value::operator=(tagged_value const& other)
+	{
+		if (this != &other)
+			*this = tagged_value{ other };
+		return *this;
+	}
+
+	tagged_value& tagged_value::operator=(tagged_value&& other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			std::memcpy((void*)this, (void const*)&other, sizeof(tagged_value));
+			other.m_small.tag = kind::null;
+		}
+		return *this;
+	}
+
+	tagged_value::tagged_value(kind k, array_t elements, std::pmr::memory_resource* arena) : tagged_value()
+	{
+		m_large.tag = k;
+		if (arena)
+		{
+			/// Never destroyed, so it doesn't matter that the arena cannot free it
+			m_large.size = borrowed;
+			m_large.payload.elements = new (arena->allocate(sizeof(array_t), alignof(array_t))) array_t(std::move(elements), arena);
+		}
+		else
+			m_large.payload.elements = new array_t(std::move(elements));
+	}
+
+	tagged_value tagged_value::make_view(std::string_view str) noexcept
+	{
+		tagged_value result;
+		if (str.size() <= small_string_capacity || str.size() > std::numeric_limits<uint32_t>::max())
+		{
+			result.set_text(kind::string, str);
+			return result;
+		}
+		result.m_large.tag = kind::string;
+		result.m_large.size = borrowed;
+		result.m_large.length = uint32_t(str.size());
+		result.m_large.payload.chars = str.data();
+		return result;
+	}
+
+	void tagged_value::set_text(kind k, std::string_view str, std::pmr::memory_resource* arena)
+	{
+		release();
+		if (str.size() <= small_string_capacity)
+		{
+			m_small.tag = k;
+			m_small.size = uint8_t(str.size());
+			std::memcpy(m_small.chars, str.data(), str.size());
+		}
+		else if (arena && str.size() <= std::numeric_limits<uint32_t>::max())
+		{
+			const auto chars = static_cast<char*>(arena->allocate(str.size(), 1));
+			std::memcpy(chars, str.data(), str.size());
+			m_large.tag = k;
+			m_large.size = borrowed;
+			m_large.length = uint32_t(str.size());
+			m_large.payload.chars = chars;
+		}
+		else
+		{
+			m_large.tag = k;
+			m_large.size = heap_text;
+			m_large.payload.text = new std::string(str);
+		}
+	}
+
+	void tagged_value::release() noexcept
+	{
+		if (is_borrowed())
+		{
+			m_small.tag = kind::null;
+			m_small.size = 0;
+			return;
+		}
+
+		switch (type())
+		{
+		case kind::string:
+		case kind::error:
+			if (m_small.size == heap_text)
+				delete m_large.payload.text;
+			break;
+		case kind::call:
+		case kind::array:
+			delete m_large.payload.elements;
+			break;
+		case kind::object:
+			delete m_large.payload.object;
+			break;
+		default:
+			break;
+		}
+		m_small.tag = kind::null;
+		m_small.size = 0;
+	}
+
+	json tagged_value::to_json(symbol_table const& symbols) const
+	{
+		switch (type())
+		{
+		case kind::null: return nullptr;
+		case kind::boolean: return as_boolean();
+		case kind::integer: return as_integer();
+		case kind::unsigned_integer: return as_unsigned();
+		case kind::floating: return as_double();
+		case kind::string: return str();
+		case kind::word: return symbols.name(as_word());
+		case kind::call:
+		case kind::array:
+		{
+			json result = json::array();
+			auto& result_array = result.get_ref<json::array_t&>();
+			result_array.reserve(elements().size());
+			for (auto const& element : elements())
+				result_array.push_back(element.to_json(symbols));
+			return result;
+		}
+		case kind::object:
+		{
+			json result = json::object();
+			for (auto const& [key, member] : members())
+				result.emplace(key, member.to_json(symbols));
+			return result;
+		}
+		case kind::error:
+			return make_error_value(str());
+		}
+		return nullptr;
+	}
+
+	tagged_value tagged_value::from_json(json const& j)
+	{
+		switch (j.type())
+		{
+		case json::value_t::boolean: return j.get<bool>();
+		case json::value_t::number_integer: return j.get<json::number_integer_t>();
+		case json::value_t::number_unsigned: return j.get<json::number_unsigned_t>();
+		case json::value_t::number_float: return j.get<json::number_float_t>();
+		case json::value_t::string: return tagged_value{ std::string_view{ j.get_ref<json::string_t const&>() } };
+		case json::value_t::array:
+		{
+			array_t elements;
+			elements.reserve(j.size());
+			for (auto const& element : j)
+				elements.push_back(from_json(element));
+			return make_array(std::move(elements));
+		}
+		case json::value_t::object:
+		{
+			object_t members;
+			for (auto const& [key, member] : j.items())
+				members.emplace(key, from_json(member));
+			return make_object(std::move(members));
+		}
+		case json::value_t::binary:
+			if (is_error_value(j))
+				return make_error(error_message(j));
+			return nullptr;
+		default:
+			return nullptr;
+		}
+	}
+}